@@ -1,257 +1,1751 @@
 #include "filesys/buffer-cache.h"
 #include <bitmap.h>
-#include <hash.h>
+#include <list.h>
+#include <round.h>
 #include <string.h>
+#include <syscall-nr.h>
 #include "filesys/filesys.h"
+#include "threads/loader.h"
 #include "threads/thread.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 #include "devices/timer.h"
 
-#define NUM_SECTORS 64
+#define NUM_SHARDS 4
+#define BLOCKS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
 #define WRITE_DELAY 30000
+#define DIRTY_HIGH 50
+#define PREFETCH_SLOTS 64
+#define CLEAN_AHEAD_MAX 32
+#define META_PERCENT 50
+#define MAX_PERCENT 25
 
-static void *cache_base;                        /* Points to the base of the buffer cache. */
-static size_t clock_hand;                       /* Used for clock replacement. */
-static struct entry *entries[NUM_SECTORS];      /* Array of cache entry refs. */
-static struct bitmap *refbits;                  /* Reference bits for clock replacement. */
-static struct bitmap *usebits;                  /* Marked for each locked entry. */
-static struct hash hashmap;                     /* Maps sector indices to cache entries. */
-static struct lock cache_lock;                  /* Acquire before accessing cache metadata. */
-static struct condition cache_queue;            /* Block if all cache entries are in use. */
-
-static void *index_to_block (size_t index);
-static bool find_entry (block_sector_t sector, struct entry **);
-unsigned hash_function (const struct hash_elem *e, void *aux);
-bool less_function (const struct hash_elem *a, const struct hash_elem *b, void *aux);
-void write_behind_thread_func (void *aux);
+/* Sector number of an entry that caches nothing. */
+#define NO_SECTOR ((block_sector_t) -1)
 
-struct entry
+/* The cache blocks of a shard holding one class of sectors,
+   along with the replacement policy state for them. The clock
+   policy only uses the clock hand. */
+struct region
+  {
+    size_t capacity;                            /* Number of cache blocks reserved. */
+    size_t cnt;                                 /* Number of cache blocks held. */
+    size_t clock_hand;                          /* Used for clock replacement. */
+    struct list queues[2];                      /* Cached entries, most recent first. */
+    size_t queue_cnt[2];                        /* Number of entries in each queue. */
+    struct list ghosts[2];                      /* Recently evicted sectors, most recent first. */
+    size_t ghost_cnt[2];                        /* Number of sectors in each ghost list. */
+    struct list free_ghosts;                    /* Unused ghost records. */
+    struct ghost *ghost_pool;                   /* All ghost records. */
+    size_t target;                              /* ARC's target size for queues[0]. */
+
+    /* Stats. */
+    size_t misses;                              /* Number of cache misses. */
+    size_t hits;                                /* Number of cache hits. */
+    size_t ghost_hits;                          /* Misses on recently evicted sectors. */
+  };
+
+/* A partition of the buffer cache. Every sector maps to exactly
+   one shard, and each shard replaces its own cache blocks under
+   its own lock, so a miss in one shard never blocks lookups in
+   another. Within a shard, metadata is kept in a region of its
+   own, so that it is not evicted by scans of file data. */
+struct shard
+  {
+    size_t size;                                /* Number of cache blocks. */
+    struct entry **entries;                     /* Array of cache entry refs. */
+    struct bitmap *refbits;                     /* Reference bits for clock replacement. */
+    struct bitmap *usebits;                     /* Marked for each locked entry. */
+    struct entry **slots;                       /* Maps sector indices to cache entries. */
+    size_t slot_mask;                           /* Number of slots, minus 1. */
+    struct lock lock;                           /* Acquire before accessing shard metadata. */
+    struct condition queue;                     /* Block if all shard entries are in use. */
+    struct list dirty;                          /* Dirty entries, in sector order. */
+    size_t dirty_cnt;                           /* Number of dirty entries. */
+    struct list free;                           /* Entries caching nothing. */
+    struct region regions[BUFFER_CLASS_CNT];    /* Cached entries, by class. */
+    struct list direct_writes;                  /* Uncached writes in progress. */
+    struct condition direct_done;               /* Signaled when one finishes. */
+
+    /* Stats. */
+    size_t clean_evictions;                     /* Evictions without a write-back. */
+    size_t dirty_evictions;                     /* Evictions with a write-back. */
+    size_t prefetches;                          /* Sectors read ahead. */
+    size_t waits;                               /* Waits for a locked entry. */
+    size_t directs;                             /* Sectors transferred uncached. */
+  };
+
+/* An uncached write of SECTOR that is in progress. */
+struct direct_write
+  {
+    block_sector_t sector;
+    struct list_elem elem;
+  };
+
+/* A sector recently evicted from a shard. */
+struct ghost
+  {
+    block_sector_t sector;
+    struct list_elem elem;
+  };
+
+static struct shard shards[NUM_SHARDS];         /* Cache partitions. */
+
+/* Identifies the cache blocks held by a page of memory. */
+struct cache_page
+  {
+    struct shard *shard;                        /* Owning shard, or null. */
+    size_t index;                               /* Index of the page's first cache block. */
+  };
+
+/* Maps physical page numbers to cache pages, so that a cache
+   block can be traced back to its entry. */
+static struct cache_page *page_map;
+
+/* Serializes resizes of the buffer cache. */
+static struct lock resize_lock;
+
+/* Initial number of cache blocks.
+   Controlled by kernel command-line option "-cache=SECTORS". */
+size_t buffer_cache_sectors = 64;
+
+/* Name of the replacement policy.
+   Controlled by kernel command-line option "-cache-policy=NAME". */
+const char *buffer_cache_policy = "clock";
+
+/* The cleaner thread writes back dirty entries just ahead of
+   the clock hands, so that misses find clean cache blocks to
+   evict instead of waiting for a write-back. */
+static struct semaphore cleaner_sema;           /* Upped to wake the cleaner. */
+static bool cleaner_woken;                      /* True if a wake-up is pending. */
+
+/* A sector waiting to be read ahead. */
+struct prefetch
   {
     block_sector_t sector;
+    enum buffer_class class;
+  };
+
+/* Sectors waiting to be read ahead by the read-ahead thread, in
+   a circular queue. Requests that find the queue full are
+   dropped, or wait for room if they must not be. */
+static struct prefetch prefetch_queue[PREFETCH_SLOTS];
+static size_t prefetch_head;                    /* Index of the oldest request. */
+static size_t prefetch_cnt;                     /* Number of queued requests. */
+static struct lock prefetch_lock;               /* Protects the queue. */
+static struct semaphore prefetch_sema;          /* Counts queued requests. */
+static struct condition prefetch_room;          /* Signaled when a request leaves. */
+
+static struct shard *block_to_shard (void *cache_block, size_t *index);
+static struct shard *sector_to_shard (block_sector_t sector);
+static bool grow_shard (struct shard *, size_t size);
+static void shrink_shard (struct shard *, size_t size);
+static bool resize_regions (struct shard *);
+static void *get_block (block_sector_t sector, enum buffer_class,
+                        bool exclusive);
+static bool find_entry (struct shard *, block_sector_t sector,
+                        enum buffer_class, bool exclusive, struct entry **);
+static size_t choose_victim (struct shard *, block_sector_t sector,
+                             enum buffer_class);
+static struct entry *lookup_entry (struct shard *, block_sector_t sector);
+static void insert_entry (struct shard *, struct entry *);
+static void remove_entry (struct shard *, struct entry *);
+static bool direct_write_pending (struct shard *, block_sector_t sector);
+static void evict_entry (struct shard *, struct entry *);
+static void demote_entry (struct shard *, struct entry *);
+static struct region *entry_region (struct shard *, struct entry *);
+static bool dirty_ahead (struct shard *);
+static struct entry *next_dirty_victim (struct shard *);
+static void write_back (struct shard *, struct entry *);
+static void mark_dirty (struct shard *, struct entry *);
+static void flush_sector (block_sector_t sector);
+static void flush_shard (struct shard *);
+static void release_entry (struct shard *, size_t index, bool dirty,
+                           bool referenced);
+void cleaner_thread_func (void *aux);
+void read_ahead_thread_func (void *aux);
+
+/* States of a cache entry. Entries in transit are pinned, and
+   the disk I/O that moves them out of transit is done without
+   holding the shard lock. */
+enum entry_state
+  {
+    ENTRY_VALID,                /* Cache block holds the sector's contents. */
+    ENTRY_READING,              /* Sector is being read into the cache block. */
+    ENTRY_WRITING               /* Cache block is being written back to disk. */
+  };
+
+/* A cache block and its metadata. Entries are allocated along
+   with their cache blocks and reused for each sector cached in
+   the block, so lookups never allocate memory. */
+struct entry
+  {
+    block_sector_t sector;      /* Cached sector, or NO_SECTOR. */
     size_t index;
-    struct condition queue;
-    struct hash_elem elem;
+    void *block;                /* Cache block. */
+    enum entry_state state;
+    unsigned readers;           /* Number of shared locks held. */
+    unsigned writers_waiting;   /* Threads waiting for an exclusive lock. */
+    struct condition queue;     /* Threads waiting for this entry. */
+    struct list_elem elem;      /* Free list or policy queue element. */
+    enum buffer_class class;    /* Class of the cached sector. */
+    int queue_idx;              /* Policy queue holding the entry. */
     bool dirty;
+    struct list_elem dirty_elem; /* Element in the shard's dirty list. */
+  };
+
+/* A replacement policy. Each region of a shard is replaced
+   independently. Policies track the entries of region R that
+   cache a sector; entries that cache nothing are kept on the
+   shard's free list and used before any victim is chosen. All
+   functions are called with the shard lock held. */
+struct cache_policy
+  {
+    const char *name;
+
+    /* Called after the capacity of R changes. Returns false if
+       memory could not be allocated. */
+    bool (*resize) (struct shard *s, struct region *r);
+
+    /* Called when E starts caching a sector after a miss. */
+    void (*insert) (struct shard *s, struct region *r, struct entry *e);
+
+    /* Called on a cache hit on E. */
+    void (*access) (struct shard *s, struct region *r, struct entry *e);
+
+    /* Called when E's sector leaves the cache. */
+    void (*evict) (struct shard *s, struct region *r, struct entry *e);
+
+    /* Called to make E, whose reference bit has been cleared, the
+       next to be evicted from its queue. */
+    void (*demote) (struct shard *s, struct region *r, struct entry *e);
+
+    /* Returns the index of a cache block of R that is not in use,
+       to be evicted to make room for SECTOR, or S's size if
+       there is none. */
+    size_t (*choose) (struct shard *s, struct region *r,
+                      block_sector_t sector);
+
+    /* Stores up to CNT of the entries of R that are next in line
+       for eviction in VICTIMS, in order, and returns the number
+       stored. */
+    size_t (*victims) (struct shard *s, struct region *r,
+                       struct entry **victims, size_t cnt);
   };
 
+static const struct cache_policy clock_policy, twoq_policy, arc_policy;
+static const struct cache_policy *policy;       /* Policy in use. */
+
 /* Initializes the buffer cache. */
 void
 buffer_cache_init (void)
 {
-  cache_base = palloc_get_multiple (PAL_ASSERT, 8);
-  clock_hand = 0;
-  refbits = bitmap_create (NUM_SECTORS);
-  usebits = bitmap_create (NUM_SECTORS);
-  hash_init (&hashmap, hash_function, less_function, NULL);
-  lock_init (&cache_lock);
-  cond_init (&cache_queue);
-  thread_create ("write-behind", PRI_MAX, write_behind_thread_func, NULL);
+  size_t i;
+
+  page_map = calloc (init_ram_pages, sizeof *page_map);
+  if (page_map == NULL)
+    PANIC ("buffer cache page map allocation failed");
 
-  // Stats.
-  cache_misses = 0;
-  cache_hits = 0;
+  if (!strcmp (buffer_cache_policy, clock_policy.name))
+    policy = &clock_policy;
+  else if (!strcmp (buffer_cache_policy, twoq_policy.name))
+    policy = &twoq_policy;
+  else if (!strcmp (buffer_cache_policy, arc_policy.name))
+    policy = &arc_policy;
+  else
+    PANIC ("unknown buffer cache policy `%s'", buffer_cache_policy);
+
+  for (i = 0; i < NUM_SHARDS; i++) {
+    struct shard *s = &shards[i];
+    int c;
+    s->size = 0;
+    s->entries = NULL;
+    s->refbits = NULL;
+    s->usebits = NULL;
+    s->slots = NULL;
+    s->slot_mask = 0;
+    lock_init (&s->lock);
+    cond_init (&s->queue);
+    list_init (&s->dirty);
+    s->dirty_cnt = 0;
+    list_init (&s->free);
+    list_init (&s->direct_writes);
+    cond_init (&s->direct_done);
+    for (c = 0; c < BUFFER_CLASS_CNT; c++) {
+      struct region *r = &s->regions[c];
+      r->capacity = 0;
+      r->cnt = 0;
+      r->clock_hand = 0;
+      list_init (&r->queues[0]);
+      list_init (&r->queues[1]);
+      r->queue_cnt[0] = r->queue_cnt[1] = 0;
+      list_init (&r->ghosts[0]);
+      list_init (&r->ghosts[1]);
+      r->ghost_cnt[0] = r->ghost_cnt[1] = 0;
+      list_init (&r->free_ghosts);
+      r->ghost_pool = NULL;
+      r->target = 0;
+      r->misses = 0;
+      r->hits = 0;
+      r->ghost_hits = 0;
+    }
+
+    // Stats.
+    s->clean_evictions = 0;
+    s->dirty_evictions = 0;
+    s->prefetches = 0;
+    s->waits = 0;
+    s->directs = 0;
+  }
+  lock_init (&resize_lock);
+  if (!buffer_cache_resize (buffer_cache_sectors))
+    PANIC ("buffer cache allocation failed");
+
+  sema_init (&cleaner_sema, 0);
+  cleaner_woken = false;
+  thread_create ("cleaner", PRI_MAX, cleaner_thread_func, NULL);
+
+  prefetch_head = prefetch_cnt = 0;
+  lock_init (&prefetch_lock);
+  sema_init (&prefetch_sema, 0);
+  cond_init (&prefetch_room);
+  thread_create ("read-ahead", PRI_MAX, read_ahead_thread_func, NULL);
 }
 
 /* Checks if SECTOR is in the buffer cache, and if it is not,
-   loads SECTOR into a cache block. "Locks" the corresponding
-   cache entry until buffer_cache_release () is called.
-   Returns the cache block containing SECTOR's contents. */
+   loads SECTOR into a cache block of the region for CLASS.
+   "Locks" the corresponding cache entry for exclusive use until
+   buffer_cache_release () is called. The shard lock is not held
+   during disk I/O. Returns the cache block containing SECTOR's
+   contents. */
 void *
-buffer_cache_get (block_sector_t sector)
+buffer_cache_get_exclusive (block_sector_t sector, enum buffer_class class)
 {
-  struct entry *e;
-  bool cache_hit;
+  return get_block (sector, class, true);
+}
+
+/* Like buffer_cache_get_exclusive (), but other threads may
+   hold shared locks on the cache entry at the same time. The
+   caller must not modify the cache block. */
+void *
+buffer_cache_get_shared (block_sector_t sector, enum buffer_class class)
+{
+  return get_block (sector, class, false);
+}
 
-  lock_acquire (&cache_lock);
-  cache_hit = find_entry (sector, &e);
-  lock_release (&cache_lock);
+/* Like buffer_cache_get_exclusive (), but does not read SECTOR
+   from disk on a miss, for callers that will overwrite the whole
+   cache block before releasing it. Until then, the returned
+   cache block's contents are undefined. */
+void *
+buffer_cache_get_for_overwrite (block_sector_t sector,
+                                enum buffer_class class)
+{
+  struct shard *s = sector_to_shard (sector);
+  struct entry *e;
 
-  if (!cache_hit)
-    block_read (fs_device, sector, index_to_block (e->index));
+  lock_acquire (&s->lock);
+  if (find_entry (s, sector, class, true, &e))
+    s->regions[class].hits++;
+  else
+    s->regions[class].misses++;
+  lock_release (&s->lock);
 
-  return index_to_block (e->index);
+  return e->block;
 }
 
 /* Releases the "lock" on the cache entry associated with
    the block at CACHE_BLOCK. The parameter DIRTY should
    be marked true if the contents of CACHE_BLOCK were
-   modified since it was returned by buffer_cache_get (). */
+   modified since it was returned by buffer_cache_get_exclusive (),
+   and must be false for a shared lock. */
 void
 buffer_cache_release (void *cache_block, bool dirty)
 {
-  int index = (cache_block - cache_base) / BLOCK_SECTOR_SIZE;
+  size_t index;
+  struct shard *s = block_to_shard (cache_block, &index);
 
-  ASSERT (index >= 0 && index < NUM_SECTORS);
-  ASSERT (bitmap_test (usebits, index));
+  lock_acquire (&s->lock);
+  release_entry (s, index, dirty, true);
+  lock_release (&s->lock);
+}
 
-  lock_acquire (&cache_lock);
+/* Like buffer_cache_release (), but moves the cache entry to the
+   cold end of the replacement order, for data that will not be
+   used again soon. */
+void
+buffer_cache_release_cold (void *cache_block, bool dirty)
+{
+  size_t index;
+  struct shard *s = block_to_shard (cache_block, &index);
 
-  if (dirty)
-    entries[index]->dirty = true;
+  lock_acquire (&s->lock);
+  release_entry (s, index, dirty, false);
+  demote_entry (s, s->entries[index]);
+  lock_release (&s->lock);
+}
 
-  bitmap_mark (refbits, index);
-  bitmap_reset (usebits, index);
-  cond_signal (&entries[index]->queue, &cache_lock);
-  cond_signal (&cache_queue, &cache_lock);
+/* Moves SECTOR to the cold end of the replacement order if it
+   is cached and not in use. */
+void
+buffer_cache_demote (block_sector_t sector)
+{
+  struct shard *s = sector_to_shard (sector);
+  struct entry *e;
 
-  lock_release (&cache_lock);
+  lock_acquire (&s->lock);
+  e = lookup_entry (s, sector);
+  if (e != NULL && !bitmap_test (s->usebits, e->index))
+    demote_entry (s, e);
+  lock_release (&s->lock);
 }
 
-/* Flushes all dirty cache entries to disk. */
+/* Queues SECTOR, of class CLASS, to be read into the buffer
+   cache in the background. If too many sectors are queued
+   already, waits for room if WAIT is true, and drops the request
+   otherwise. */
 void
-buffer_cache_flush (void)
+buffer_cache_prefetch (block_sector_t sector, enum buffer_class class,
+                       bool wait)
 {
-  size_t i = 0;
-  lock_acquire (&cache_lock);
-  for (; i < NUM_SECTORS; i++)
-    if (entries[i] != NULL && entries[i]->dirty && !bitmap_test (usebits, i)) {
-      block_write (fs_device, entries[i]->sector, index_to_block (i));
-      entries[i]->dirty = false;
+  lock_acquire (&prefetch_lock);
+  while (wait && prefetch_cnt == PREFETCH_SLOTS)
+    cond_wait (&prefetch_room, &prefetch_lock);
+  if (prefetch_cnt < PREFETCH_SLOTS) {
+    struct prefetch *p
+      = &prefetch_queue[(prefetch_head + prefetch_cnt++) % PREFETCH_SLOTS];
+    p->sector = sector;
+    p->class = class;
+    sema_up (&prefetch_sema);
+  }
+  lock_release (&prefetch_lock);
+}
+
+/* Stores up to CNT of the sectors in the buffer cache in HOT,
+   and returns the number stored. Metadata comes first, so that
+   it is read back first when HOT is replayed. */
+size_t
+buffer_cache_hot_sectors (struct buffer_cache_sector *hot, size_t cnt)
+{
+  static const enum buffer_class order[] = {BUFFER_META, BUFFER_DATA};
+  size_t n = 0, i, j, c;
+
+  for (c = 0; c < sizeof order / sizeof *order; c++)
+    for (i = 0; i < NUM_SHARDS; i++) {
+      struct shard *s = &shards[i];
+      lock_acquire (&s->lock);
+      for (j = 0; j < s->size && n < cnt; j++) {
+        struct entry *e = s->entries[j];
+        if (e->sector != NO_SECTOR && e->class == order[c]
+            && e->state != ENTRY_READING) {
+          hot[n].sector = e->sector;
+          hot[n].class = e->class;
+          n++;
+        }
+      }
+      lock_release (&s->lock);
     }
-  lock_release (&cache_lock);
+  return n;
 }
 
-/* Reads SECTOR into BUFFER. */
+/* Flushes all dirty cache entries to disk, in one ascending
+   sweep over the sectors so that runs of adjacent dirty sectors
+   are written back to back. Entries in use are skipped. No shard
+   lock is held while writing. */
 void
-buffer_cache_read (block_sector_t sector, void *buffer)
+buffer_cache_flush (void)
 {
-  void *cache_block = buffer_cache_get (sector);
+  block_sector_t *sectors[NUM_SHARDS];
+  size_t cnt[NUM_SHARDS], pos[NUM_SHARDS];
+  size_t i;
+
+  /* Take a snapshot of each shard's dirty list. */
+  for (i = 0; i < NUM_SHARDS; i++) {
+    struct shard *s = &shards[i];
+    struct list_elem *elem;
+
+    lock_acquire (&s->lock);
+    cnt[i] = pos[i] = 0;
+    sectors[i] = malloc (s->dirty_cnt * sizeof **sectors);
+    if (sectors[i] != NULL)
+      for (elem = list_begin (&s->dirty); elem != list_end (&s->dirty);
+           elem = list_next (elem))
+        sectors[i][cnt[i]++] = list_entry (elem, struct entry,
+                                           dirty_elem)->sector;
+    lock_release (&s->lock);
+  }
+
+  /* Merge the snapshots. */
+  for (;;) {
+    size_t next = NUM_SHARDS;
+    for (i = 0; i < NUM_SHARDS; i++)
+      if (pos[i] < cnt[i]
+          && (next == NUM_SHARDS
+              || sectors[i][pos[i]] < sectors[next][pos[next]]))
+        next = i;
+    if (next == NUM_SHARDS)
+      break;
+    flush_sector (sectors[next][pos[next]++]);
+  }
+
+  /* Shards whose snapshot could not be allocated are written back
+     entry by entry instead. */
+  for (i = 0; i < NUM_SHARDS; i++) {
+    if (sectors[i] == NULL)
+      flush_shard (&shards[i]);
+    free (sectors[i]);
+  }
+}
+
+/* Reads SECTOR, of class CLASS, into BUFFER. */
+void
+buffer_cache_read (block_sector_t sector, void *buffer,
+                   enum buffer_class class)
+{
+  void *cache_block = buffer_cache_get_shared (sector, class);
   memcpy (buffer, cache_block, BLOCK_SECTOR_SIZE);
   buffer_cache_release (cache_block, false);
 }
 
-/* Writes BLOCK_SECTOR_SIZE bytes from BUFFER into SECTOR. */
+/* Writes BLOCK_SECTOR_SIZE bytes from BUFFER into SECTOR, of
+   class CLASS. */
 void
-buffer_cache_write (block_sector_t sector, void *buffer)
+buffer_cache_write (block_sector_t sector, void *buffer,
+                    enum buffer_class class)
 {
+  void *cache_block = buffer_cache_get_for_overwrite (sector, class);
+  memcpy (cache_block, buffer, BLOCK_SECTOR_SIZE);
+  buffer_cache_release (cache_block, true);
+}
+
+/* Reads SECTOR into BUFFER without caching it. If SECTOR is
+   cached anyway, it is copied from its cache block, since that
+   may be newer than the sector on disk. */
+void
+buffer_cache_read_direct (block_sector_t sector, void *buffer)
+{
+  struct shard *s = sector_to_shard (sector);
   struct entry *e;
+  enum buffer_class class = BUFFER_DATA;
 
-  lock_acquire (&cache_lock);
-  find_entry (sector, &e);
-  lock_release (&cache_lock);
+  lock_acquire (&s->lock);
+  e = lookup_entry (s, sector);
+  if (e != NULL)
+    class = e->class;
+  else
+    s->directs++;
+  lock_release (&s->lock);
 
-  void *cache_block = index_to_block (e->index);
-  memcpy (cache_block, buffer, BLOCK_SECTOR_SIZE);
-  buffer_cache_release (cache_block, true);
+  if (e != NULL)
+    buffer_cache_read (sector, buffer, class);
+  else
+    block_read (fs_device, sector, buffer);
+}
+
+/* Writes BLOCK_SECTOR_SIZE bytes from BUFFER into SECTOR without
+   caching it. If SECTOR is cached anyway, its cache block is
+   overwritten instead. Until the write reaches the disk, misses
+   on SECTOR wait for it, so that they do not read stale data. */
+void
+buffer_cache_write_direct (block_sector_t sector, const void *buffer)
+{
+  struct shard *s = sector_to_shard (sector);
+  struct direct_write w;
+  struct entry *e;
+
+  lock_acquire (&s->lock);
+  e = lookup_entry (s, sector);
+  if (e != NULL) {
+    enum buffer_class class = e->class;
+    lock_release (&s->lock);
+    buffer_cache_write (sector, (void *) buffer, class);
+    return;
+  }
+  w.sector = sector;
+  list_push_back (&s->direct_writes, &w.elem);
+  s->directs++;
+  lock_release (&s->lock);
+
+  block_write (fs_device, sector, buffer);
+
+  lock_acquire (&s->lock);
+  list_remove (&w.elem);
+  cond_broadcast (&s->direct_done, &s->lock);
+  lock_release (&s->lock);
+}
+
+/* Grows or shrinks the buffer cache to hold about SECTORS cache
+   blocks, rounded up so that each shard gets whole pages from
+   the kernel pool. The cache takes at most MAX_PERCENT of RAM,
+   and larger sizes are cut down to that. Shrinking writes back
+   and evicts the entries of the released cache blocks, waiting
+   for them if they are in use. Returns false if memory ran out
+   while growing, in which case the cache keeps its old size. */
+bool
+buffer_cache_resize (size_t sectors)
+{
+  size_t max_size = init_ram_pages * MAX_PERCENT / 100 / NUM_SHARDS
+                    * BLOCKS_PER_PAGE;
+  size_t old_size[NUM_SHARDS];
+  size_t size;
+  bool success = true;
+  size_t i;
+
+  if (sectors > max_size * NUM_SHARDS)
+    sectors = max_size * NUM_SHARDS;
+  size = DIV_ROUND_UP (sectors, NUM_SHARDS * BLOCKS_PER_PAGE)
+         * BLOCKS_PER_PAGE;
+  if (size == 0)
+    size = BLOCKS_PER_PAGE;
+
+  lock_acquire (&resize_lock);
+  for (i = 0; i < NUM_SHARDS && success; i++) {
+    struct shard *s = &shards[i];
+    lock_acquire (&s->lock);
+    old_size[i] = s->size;
+    if (size > s->size)
+      success = grow_shard (s, size);
+    else
+      shrink_shard (s, size);
+    lock_release (&s->lock);
+  }
+
+  /* Give back what the shards gained if one could not grow. */
+  if (!success)
+    while (i-- > 0) {
+      struct shard *s = &shards[i];
+      lock_acquire (&s->lock);
+      if (s->size > old_size[i] && old_size[i] > 0)
+        shrink_shard (s, old_size[i]);
+      lock_release (&s->lock);
+    }
+  lock_release (&resize_lock);
+  return success;
 }
 
-/* Resets the cache and stats.
-   May PANIC if cache is in use.
+/* Returns the statistic STATNUM, one of the BUFFER_STAT_* values
+   in <syscall-nr.h>. Cache statistics are summed over all
+   shards unless STATNUM was built with BUFFER_STAT_SHARD (). */
+size_t
+buffer_cache_stat (int statnum)
+{
+  int stat = statnum & 0xff;
+  int shard = (statnum >> 8) - 1;
+  size_t i, value = 0;
+
+  if (stat == BUFFER_STAT_READS)
+    return block_read_cnt (fs_device);
+  if (stat == BUFFER_STAT_WRITES)
+    return block_write_cnt (fs_device);
+  if (stat == BUFFER_STAT_SHARDS)
+    return NUM_SHARDS;
+
+  for (i = 0; i < NUM_SHARDS; i++)
+    if (shard < 0 || (size_t) shard == i) {
+      struct region *data = &shards[i].regions[BUFFER_DATA];
+      struct region *meta = &shards[i].regions[BUFFER_META];
+      if (stat == BUFFER_STAT_MISSES)
+        value += data->misses + meta->misses;
+      else if (stat == BUFFER_STAT_HITS)
+        value += data->hits + meta->hits;
+      else if (stat == BUFFER_STAT_DATA_MISSES)
+        value += data->misses;
+      else if (stat == BUFFER_STAT_DATA_HITS)
+        value += data->hits;
+      else if (stat == BUFFER_STAT_META_MISSES)
+        value += meta->misses;
+      else if (stat == BUFFER_STAT_META_HITS)
+        value += meta->hits;
+      else if (stat == BUFFER_STAT_CLEAN_EVICTIONS)
+        value += shards[i].clean_evictions;
+      else if (stat == BUFFER_STAT_DIRTY_EVICTIONS)
+        value += shards[i].dirty_evictions;
+      else if (stat == BUFFER_STAT_SIZE)
+        value += shards[i].size;
+      else if (stat == BUFFER_STAT_PREFETCHES)
+        value += shards[i].prefetches;
+      else if (stat == BUFFER_STAT_WAITS)
+        value += shards[i].waits;
+      else if (stat == BUFFER_STAT_GHOST_HITS)
+        value += data->ghost_hits + meta->ghost_hits;
+      else if (stat == BUFFER_STAT_DIRTY)
+        value += shards[i].dirty_cnt;
+      else if (stat == BUFFER_STAT_DIRECT)
+        value += shards[i].directs;
+    }
+  return value;
+}
+
+/* Resets the cache and stats, after writing back the dirty
+   entries. Data not yet in the cache, such as delayed data
+   blocks, is the caller's to flush first; see filesys_flush ().
+   Waits for the entries in use, such as those pinned by the
+   cleaner, write-behind and read-ahead threads, to be released.
    Use only for testing purposes. */
 void
 buffer_cache_reset (void)
 {
   buffer_cache_flush ();
 
-  lock_acquire (&cache_lock);
+  size_t i, j;
+  int c;
+  for (i = 0; i < NUM_SHARDS; i++) {
+    struct shard *s = &shards[i];
+    lock_acquire (&s->lock);
 
-  /* It's your fault if this causes a panic. */
-  ASSERT (bitmap_none (usebits, 0, NUM_SECTORS));
+    /* Wait until no entry is in use, and write back the entries
+       dirtied since the flush above, so that none are dropped.
+       The lock is released while waiting or writing, so start
+       over after each. */
+    for (;;) {
+      if ((j = bitmap_scan (s->usebits, 0, 1, true)) != BITMAP_ERROR)
+        cond_wait (&s->entries[j]->queue, &s->lock);
+      else if (!list_empty (&s->dirty))
+        write_back (s, list_entry (list_front (&s->dirty),
+                                   struct entry, dirty_elem));
+      else
+        break;
+    }
+    ASSERT (s->dirty_cnt == 0);
+
+    /* Clear all entries. */
+    for (j = 0; j < s->size; j++)
+      if (s->entries[j]->sector != NO_SECTOR) {
+        evict_entry (s, s->entries[j]);
+        s->entries[j]->sector = NO_SECTOR;
+        list_push_back (&s->free, &s->entries[j]->elem);
+      }
+
+    bitmap_set_all (s->refbits, false);
+    resize_regions (s);
 
-  /* Clear all entries. */
+    /* Reset stats. */
+    for (c = 0; c < BUFFER_CLASS_CNT; c++) {
+      s->regions[c].misses = 0;
+      s->regions[c].hits = 0;
+      s->regions[c].ghost_hits = 0;
+    }
+    s->clean_evictions = 0;
+    s->dirty_evictions = 0;
+    s->prefetches = 0;
+    s->waits = 0;
+    s->directs = 0;
+
+    lock_release (&s->lock);
+  }
+}
+
+/* Returns the shard that holds CACHE_BLOCK, and stores the
+   index of CACHE_BLOCK within it in *INDEX. */
+static struct shard *
+block_to_shard (void *cache_block, size_t *index)
+{
+  struct cache_page *page = &page_map[pg_no ((void *) vtop (cache_block))];
+
+  ASSERT (page->shard != NULL);
+  *index = page->index + pg_ofs (cache_block) / BLOCK_SECTOR_SIZE;
+  return page->shard;
+}
+
+/* Returns the shard that caches SECTOR. */
+static struct shard *
+sector_to_shard (block_sector_t sector)
+{
+  return &shards[sector % NUM_SHARDS];
+}
+
+/* Grows shard S to SIZE cache blocks, a multiple of
+   BLOCKS_PER_PAGE, allocating new pages from the kernel pool
+   along with an entry for each of their cache blocks. Must be
+   called with S's lock held. Returns true if successful, false
+   if memory ran out first. */
+static bool
+grow_shard (struct shard *s, size_t size)
+{
+  struct entry **entries = malloc (size * sizeof *entries);
+  struct bitmap *refbits = bitmap_create (size);
+  struct bitmap *usebits = bitmap_create (size);
+  size_t slot_cnt = 1;
+  struct entry **slots;
   size_t i;
-  for (i = 0; i < NUM_SECTORS; i++)
-    if (entries[i] != NULL) {
-      hash_delete (&hashmap, &entries[i]->elem);
-      free (entries[i]);
-      entries[i] = NULL;
+
+  /* Keep the sector index at most half full. */
+  while (slot_cnt < 2 * size)
+    slot_cnt *= 2;
+  slots = calloc (slot_cnt, sizeof *slots);
+
+  if (entries == NULL || refbits == NULL || usebits == NULL || slots == NULL) {
+    free (entries);
+    free (slots);
+    if (refbits != NULL)
+      bitmap_destroy (refbits);
+    if (usebits != NULL)
+      bitmap_destroy (usebits);
+    return false;
+  }
+
+  /* Move the existing cache blocks over. */
+  for (i = 0; i < s->size; i++) {
+    entries[i] = s->entries[i];
+    bitmap_set (refbits, i, bitmap_test (s->refbits, i));
+    bitmap_set (usebits, i, bitmap_test (s->usebits, i));
+  }
+  free (s->entries);
+  free (s->slots);
+  if (s->refbits != NULL)
+    bitmap_destroy (s->refbits);
+  if (s->usebits != NULL)
+    bitmap_destroy (s->usebits);
+  s->entries = entries;
+  s->refbits = refbits;
+  s->usebits = usebits;
+  s->slots = slots;
+  s->slot_mask = slot_cnt - 1;
+  for (i = 0; i < s->size; i++)
+    if (entries[i]->sector != NO_SECTOR)
+      insert_entry (s, entries[i]);
+
+  /* Add new pages. */
+  while (s->size < size) {
+    void *page = palloc_get_page (0);
+    struct entry *group = malloc (BLOCKS_PER_PAGE * sizeof *group);
+    if (page == NULL || group == NULL) {
+      if (page != NULL)
+        palloc_free_page (page);
+      free (group);
+      resize_regions (s);
+      return false;
     }
+    page_map[pg_no ((void *) vtop (page))].shard = s;
+    page_map[pg_no ((void *) vtop (page))].index = s->size;
+
+    for (i = 0; i < BLOCKS_PER_PAGE; i++) {
+      struct entry *e = &group[i];
+      e->sector = NO_SECTOR;
+      e->index = s->size;
+      e->block = page + i * BLOCK_SECTOR_SIZE;
+      e->class = BUFFER_DATA;
+      e->state = ENTRY_VALID;
+      e->readers = 0;
+      e->writers_waiting = 0;
+      e->dirty = false;
+      cond_init (&e->queue);
+      list_push_back (&s->free, &e->elem);
+      entries[s->size++] = e;
+    }
+  }
+  return resize_regions (s);
+}
+
+/* Shrinks shard S to SIZE cache blocks, a nonzero multiple of
+   BLOCKS_PER_PAGE, returning the freed pages to the kernel pool.
+   Blocks are evicted from the end of S, after waiting for them
+   to be released and writing them back if they are dirty. Must
+   be called with S's lock held. */
+static void
+shrink_shard (struct shard *s, size_t size)
+{
+  int c;
 
-  ASSERT (hash_size (&hashmap) == 0);
+  ASSERT (size > 0 && size % BLOCKS_PER_PAGE == 0);
 
-  bitmap_set_all (refbits, false);
+  while (s->size > size) {
+    size_t index = s->size - 1;
+    struct entry *e = s->entries[index];
 
-  /* Reset stats. */
-  cache_misses = 0;
-  cache_hits = 0;
+    if (bitmap_test (s->usebits, index))
+      cond_wait (&e->queue, &s->lock);
+    else if (e->dirty)
+      write_back (s, e);
+    else {
+      if (e->sector != NO_SECTOR)
+        evict_entry (s, e);
+      else
+        list_remove (&e->elem);
+      bitmap_reset (s->refbits, index);
 
-  lock_release (&cache_lock);
+      /* Release the page, and the entries allocated with it, once
+         all of its blocks are gone. */
+      if (index % BLOCKS_PER_PAGE == 0) {
+        page_map[pg_no ((void *) vtop (e->block))].shard = NULL;
+        palloc_free_page (e->block);
+        free (e);
+      }
+      s->size--;
+    }
+  }
+  for (c = 0; c < BUFFER_CLASS_CNT; c++)
+    s->regions[c].clock_hand %= s->size;
+  resize_regions (s);
+}
+
+/* Reserves META_PERCENT of S's cache blocks for metadata and the
+   rest for file data, and lets the policy adjust. Returns false
+   if memory ran out. */
+static bool
+resize_regions (struct shard *s)
+{
+  struct region *meta = &s->regions[BUFFER_META];
+  struct region *data = &s->regions[BUFFER_DATA];
+  bool success;
+
+  meta->capacity = s->size * META_PERCENT / 100;
+  data->capacity = s->size - meta->capacity;
+  success = policy->resize (s, meta);
+  return policy->resize (s, data) && success;
 }
 
-/* Returns a pointer to the (INDEX + 1)th cache block. */
+/* Looks up SECTOR, of class CLASS, in the buffer cache,
+   reading it in on a miss, and "locks" its cache entry, for
+   exclusive use if EXCLUSIVE is true and shared use otherwise.
+   Returns the cache block containing SECTOR's contents. */
 static void *
-index_to_block (size_t index) {
-  return cache_base + BLOCK_SECTOR_SIZE * index;
+get_block (block_sector_t sector, enum buffer_class class, bool exclusive)
+{
+  struct shard *s = sector_to_shard (sector);
+  struct entry *e;
+  bool cache_hit;
+
+  lock_acquire (&s->lock);
+  cache_hit = find_entry (s, sector, class, exclusive, &e);
+  if (cache_hit)
+    s->regions[class].hits++;
+  else
+    s->regions[class].misses++;
+  lock_release (&s->lock);
+
+  if (!cache_hit) {
+    block_read (fs_device, sector, e->block);
+
+    /* Let other readers in as soon as the block is filled. */
+    if (!exclusive) {
+      lock_acquire (&s->lock);
+      e->state = ENTRY_VALID;
+      e->readers = 1;
+      e->writers_waiting = 0;
+      cond_broadcast (&e->queue, &s->lock);
+      lock_release (&s->lock);
+    }
+  }
+
+  return e->block;
 }
 
-/* Checks if SECTOR is in the buffer cache, and if it is not,
-   allocates a cache block for it. "Locks" the corresponding
-   cache entry and stores it in ENTRY.
-   Returns true on a cache hit, false otherwise. */
+/* Checks if SECTOR is in shard S, and if it is not, evicts a
+   cache block for it and adds it to the region for CLASS. A hit
+   leaves SECTOR in the region it is in. "Locks" the corresponding
+   cache entry,
+   for exclusive use if EXCLUSIVE is true and shared use
+   otherwise, and stores it in ENTRY. Must be called with S's
+   lock held, but releases it while writing back an evicted
+   entry. Returns true on a cache hit. Otherwise returns false,
+   and ENTRY is left locked for exclusive use in the
+   ENTRY_READING state for the caller to fill in. */
 static bool
-find_entry (block_sector_t sector, struct entry **entry)
+find_entry (struct shard *s, block_sector_t sector,
+            enum buffer_class class, bool exclusive, struct entry **entry)
 {
-  struct entry *e = malloc (sizeof (struct entry));
+  struct entry *e;
+  size_t index;
+
+  for (;;) {
+    e = lookup_entry (s, sector);
+    if (e != NULL) {
+      /* Readers may share E with other readers, unless a writer
+         is waiting for it. */
+      if (e->state == ENTRY_VALID
+          && (!bitmap_test (s->usebits, e->index)
+              || (!exclusive && e->readers > 0 && e->writers_waiting == 0))) {
+        bitmap_mark (s->usebits, e->index);
+        if (!exclusive)
+          e->readers++;
+        policy->access (s, entry_region (s, e), e);
+        *entry = e;
+        return true;
+      }
+
+      /* Wait until E is filled, written back or released. It may
+         have been evicted by then, so look it up again. */
+      s->waits++;
+      if (exclusive)
+        e->writers_waiting++;
+      cond_wait (&e->queue, &s->lock);
+      continue;
+    }
+
+    /* Wait for an uncached write of SECTOR to reach the disk. */
+    if (direct_write_pending (s, sector)) {
+      cond_wait (&s->direct_done, &s->lock);
+      continue;
+    }
+
+    /* Wait if all the cache blocks are in use. */
+    if (bitmap_all (s->usebits, 0, s->size)) {
+      cond_wait (&s->queue, &s->lock);
+      continue;
+    }
+
+    /* Use a free entry if there is one. */
+    if (!list_empty (&s->free)) {
+      e = list_entry (list_pop_front (&s->free), struct entry, elem);
+      index = e->index;
+      break;
+    }
+
+    index = choose_victim (s, sector, class);
+    e = s->entries[index];
+    if (e->dirty) {
+      /* Write the victim back first. SECTOR may have been cached,
+         or the victim used again, in the meantime. */
+      write_back (s, e);
+      if (lookup_entry (s, sector) != NULL || e->dirty
+          || bitmap_test (s->usebits, index))
+        continue;
+      s->dirty_evictions++;
+    }
+    else
+      s->clean_evictions++;
+    break;
+  }
+
+  /* Reuse the victim's entry for SECTOR. Until it is filled in,
+     lookups of SECTOR wait on its queue. */
+  if (e->sector != NO_SECTOR)
+    evict_entry (s, e);
   e->sector = sector;
+  e->class = class;
+  e->state = ENTRY_READING;
+  e->readers = 0;
+  insert_entry (s, e);
+  s->regions[class].cnt++;
+  policy->insert (s, &s->regions[class], e);
+  bitmap_mark (s->usebits, index);
+
+  /* Keep the cleaner ahead of the clock hand. */
+  if (dirty_ahead (s) && !cleaner_woken) {
+    cleaner_woken = true;
+    sema_up (&cleaner_sema);
+  }
+
+  *entry = e;
+  return false;
+}
+
+/* Returns the index of a cache block of S that is not in use, to
+   be evicted to make room for SECTOR, of class CLASS. File data
+   may fill any cache block that metadata does not, but metadata
+   can claim blocks back up to the capacity of its region: a miss
+   on metadata evicts file data until then, and a miss on file
+   data evicts metadata only beyond it. If the region chosen has
+   no block that is not in use, the other one gives one up. */
+static size_t
+choose_victim (struct shard *s, block_sector_t sector,
+               enum buffer_class class)
+{
+  struct region *meta = &s->regions[BUFFER_META];
+  enum buffer_class victim = BUFFER_DATA;
+  size_t index;
+
+  if (meta->cnt > meta->capacity
+      || (class == BUFFER_META && meta->cnt == meta->capacity))
+    victim = BUFFER_META;
+  index = policy->choose (s, &s->regions[victim], sector);
+  if (index == s->size)
+    index = policy->choose (s, &s->regions[!victim], sector);
+  ASSERT (index < s->size);
+  return index;
+}
+
+/* Returns the region of S holding E. */
+static struct region *
+entry_region (struct shard *s, struct entry *e)
+{
+  return &s->regions[e->class];
+}
+
+/* Returns the slot in S's sector index where a search for
+   SECTOR begins. Every sector of S is congruent modulo
+   NUM_SHARDS, so that factor is divided out first. */
+static size_t
+home_slot (struct shard *s, block_sector_t sector)
+{
+  return (sector / NUM_SHARDS) * 2654435761u & s->slot_mask;
+}
 
-  /* Wait if all the cache blocks are in use. */
-  while (bitmap_all (usebits, 0, NUM_SECTORS))
-    cond_wait (&cache_queue, &cache_lock);
+/* Returns the entry of S caching SECTOR, or a null pointer if
+   there is none. The sector index uses open addressing with
+   linear probing. */
+static struct entry *
+lookup_entry (struct shard *s, block_sector_t sector)
+{
+  size_t i;
+  for (i = home_slot (s, sector); s->slots[i] != NULL;
+       i = (i + 1) & s->slot_mask)
+    if (s->slots[i]->sector == sector)
+      return s->slots[i];
+  return NULL;
+}
+
+/* Adds E, which must not be in S's sector index, to it. */
+static void
+insert_entry (struct shard *s, struct entry *e)
+{
+  size_t i = home_slot (s, e->sector);
+  while (s->slots[i] != NULL)
+    i = (i + 1) & s->slot_mask;
+  s->slots[i] = e;
+}
 
-  struct hash_elem *found = hash_insert (&hashmap, &e->elem);
-  if (found == NULL) {
-    cache_misses++;
+/* Removes E from S's sector index. Entries further along E's
+   probe sequence are shifted back into the hole, so that no
+   search stops short of them. */
+static void
+remove_entry (struct shard *s, struct entry *e)
+{
+  size_t i = home_slot (s, e->sector);
+  size_t j;
+
+  while (s->slots[i] != e)
+    i = (i + 1) & s->slot_mask;
+  s->slots[i] = NULL;
 
-    /* Clock algorithm. */
-    while (bitmap_test (refbits, clock_hand) || bitmap_test (usebits, clock_hand)) {
-      bitmap_reset (refbits, clock_hand);
-      clock_hand = (clock_hand + 1) % NUM_SECTORS;
+  for (j = (i + 1) & s->slot_mask; s->slots[j] != NULL;
+       j = (j + 1) & s->slot_mask) {
+    /* Move the entry in slot J to the hole at slot I unless its
+       home slot lies cyclically in (I, J]. */
+    size_t home = home_slot (s, s->slots[j]->sector);
+    if (((j - home) & s->slot_mask) >= ((j - i) & s->slot_mask)) {
+      s->slots[i] = s->slots[j];
+      s->slots[j] = NULL;
+      i = j;
     }
+  }
+}
+
+/* Removes E's sector from S, leaving E caching nothing. */
+static void
+evict_entry (struct shard *s, struct entry *e)
+{
+  struct region *r = entry_region (s, e);
+  policy->evict (s, r, e);
+  r->cnt--;
+  remove_entry (s, e);
+}
+
+/* Clears the reference bit of E, an entry of S, and lets the
+   policy put E next in line for eviction. */
+static void
+demote_entry (struct shard *s, struct entry *e)
+{
+  bitmap_reset (s->refbits, e->index);
+  policy->demote (s, entry_region (s, e), e);
+}
+
+/* Returns true if an uncached write of SECTOR to S is in
+   progress. */
+static bool
+direct_write_pending (struct shard *s, block_sector_t sector)
+{
+  struct list_elem *elem;
+  for (elem = list_begin (&s->direct_writes);
+       elem != list_end (&s->direct_writes); elem = list_next (elem))
+    if (list_entry (elem, struct direct_write, elem)->sector == sector)
+      return true;
+  return false;
+}
+
+/* Returns the number of cache blocks next in line for eviction
+   from each region of S that the cleaner keeps clean. */
+static size_t
+clean_watermark (struct shard *s)
+{
+  return s->size / 4 < CLEAN_AHEAD_MAX ? s->size / 4 : CLEAN_AHEAD_MAX;
+}
+
+/* Returns true if fewer than clean_watermark (S) of the cache
+   blocks next in line for eviction from a region of S are
+   clean. */
+static bool
+dirty_ahead (struct shard *s)
+{
+  struct entry *victims[CLEAN_AHEAD_MAX];
+  size_t i, cnt;
+  int c;
+
+  for (c = 0; c < BUFFER_CLASS_CNT; c++) {
+    cnt = policy->victims (s, &s->regions[c], victims, clean_watermark (s));
+    for (i = 0; i < cnt; i++)
+      if (victims[i]->dirty)
+        return true;
+  }
+  return false;
+}
+
+/* Returns a dirty entry of S that is not in use and is among the
+   next clean_watermark (S) in line for eviction from its region,
+   or a null pointer if there is none. */
+static struct entry *
+next_dirty_victim (struct shard *s)
+{
+  struct entry *victims[CLEAN_AHEAD_MAX];
+  size_t i, cnt;
+  int c;
+
+  for (c = 0; c < BUFFER_CLASS_CNT; c++) {
+    cnt = policy->victims (s, &s->regions[c], victims, clean_watermark (s));
+    for (i = 0; i < cnt; i++)
+      if (victims[i]->dirty && !bitmap_test (s->usebits, victims[i]->index))
+        return victims[i];
+  }
+  return NULL;
+}
+
+/* Writes the contents of E, a dirty entry of S that is not in
+   use, back to disk. E is pinned in the ENTRY_WRITING state while
+   S's lock, which must be held, is released for the write. */
+static void
+write_back (struct shard *s, struct entry *e)
+{
+  ASSERT (e->dirty && !bitmap_test (s->usebits, e->index));
 
-    /* Evict entry and write contents to disk. */
-    struct entry *old_entry = entries[clock_hand];
-    if (old_entry != NULL) {
-      block_write (fs_device, old_entry->sector, index_to_block (old_entry->index));
-      hash_delete (&hashmap, &old_entry->elem);
-      free (old_entry);
+  e->state = ENTRY_WRITING;
+  e->dirty = false;
+  list_remove (&e->dirty_elem);
+  s->dirty_cnt--;
+  bitmap_mark (s->usebits, e->index);
+  lock_release (&s->lock);
+
+  block_write (fs_device, e->sector, e->block);
+
+  lock_acquire (&s->lock);
+  e->state = ENTRY_VALID;
+  bitmap_reset (s->usebits, e->index);
+  e->writers_waiting = 0;
+  cond_broadcast (&e->queue, &s->lock);
+  cond_signal (&s->queue, &s->lock);
+}
+
+/* Marks E, a clean entry of S, dirty, and adds it to S's dirty
+   list. The list is searched from the back, since sectors tend
+   to be dirtied in ascending order. */
+static void
+mark_dirty (struct shard *s, struct entry *e)
+{
+  struct list_elem *elem;
+
+  for (elem = list_rbegin (&s->dirty); elem != list_rend (&s->dirty);
+       elem = list_prev (elem))
+    if (list_entry (elem, struct entry, dirty_elem)->sector < e->sector)
+      break;
+  list_insert (list_next (elem), &e->dirty_elem);
+  e->dirty = true;
+  s->dirty_cnt++;
+}
+
+/* Writes SECTOR back to disk if it is cached, dirty and not in
+   use. */
+static void
+flush_sector (block_sector_t sector)
+{
+  struct shard *s = sector_to_shard (sector);
+  struct entry *e;
+
+  lock_acquire (&s->lock);
+  e = lookup_entry (s, sector);
+  if (e != NULL && e->dirty && !bitmap_test (s->usebits, e->index))
+    write_back (s, e);
+  lock_release (&s->lock);
+}
+
+/* Writes back the dirty entries of S that are not in use, in
+   ascending sector order, without a snapshot of S's dirty list.
+   The list is searched again from its front after each write,
+   since it may change while S's lock is released. */
+static void
+flush_shard (struct shard *s)
+{
+  block_sector_t next = 0;
+  struct list_elem *elem;
+
+  lock_acquire (&s->lock);
+  elem = list_begin (&s->dirty);
+  while (elem != list_end (&s->dirty)) {
+    struct entry *e = list_entry (elem, struct entry, dirty_elem);
+    if (e->sector < next || bitmap_test (s->usebits, e->index))
+      elem = list_next (elem);
+    else {
+      next = e->sector + 1;
+      write_back (s, e);
+      elem = list_begin (&s->dirty);
     }
+  }
+  lock_release (&s->lock);
+}
+
+/* Returns how long the write-behind thread waits between
+   flushes, in milliseconds. The wait shrinks from WRITE_DELAY
+   with an empty cache to WRITE_DELAY_MIN once DIRTY_HIGH percent
+   of it is dirty, so bursts of writes are flushed while they are
+   still small. */
+int
+buffer_cache_write_delay (void)
+{
+  size_t dirty = 0, size = 0;
+  size_t i, percent;
 
-    /* Initialize new entry. */
-    cond_init (&e->queue);
-    e->dirty = false;
-    e->index = clock_hand;
-    entries[e->index] = e;
-    clock_hand = (clock_hand + 1) % NUM_SECTORS;
+  for (i = 0; i < NUM_SHARDS; i++) {
+    dirty += shards[i].dirty_cnt;
+    size += shards[i].size;
   }
-  else {
-    cache_hits++;
-    free (e);
-    e = hash_entry (found, struct entry, elem);
+  percent = dirty * 100 / size;
+  if (percent >= DIRTY_HIGH)
+    return WRITE_DELAY_MIN;
+  return WRITE_DELAY - (WRITE_DELAY - WRITE_DELAY_MIN) * percent / DIRTY_HIGH;
+}
+
+/* Releases the "lock" on the entry in the (INDEX + 1)th cache
+   block of S, marking it dirty if DIRTY is true and setting its
+   reference bit if REFERENCED is true. Must be called with S's
+   lock held. */
+static void
+release_entry (struct shard *s, size_t index, bool dirty, bool referenced)
+{
+  struct entry *e = s->entries[index];
+
+  ASSERT (bitmap_test (s->usebits, index));
+  ASSERT (!dirty || e->readers == 0);
+
+  if (dirty && !e->dirty)
+    mark_dirty (s, e);
+
+  /* The holder of an entry in the ENTRY_READING state is
+     responsible for filling it in. */
+  e->state = ENTRY_VALID;
+
+  if (referenced)
+    bitmap_mark (s->refbits, index);
+
+  /* Keep E locked until its last reader is done. */
+  if (e->readers > 0 && --e->readers > 0)
+    return;
+
+  /* Waiting writers count themselves again if they lose the
+     race for E, so waiters never touch E after waking up. That
+     way an entry can be freed as soon as it is unlocked. */
+  bitmap_reset (s->usebits, index);
+  e->writers_waiting = 0;
+  cond_broadcast (&e->queue, &s->lock);
+  cond_signal (&s->queue, &s->lock);
+}
+
+/* Clock policy. */
+
+/* Advances R's clock hand past a cache block of R that is
+   neither in use nor recently referenced, and returns its
+   index, or S's size if R has no block that is not in use. The
+   hand passes over blocks of other regions. Dirty blocks are
+   passed over for up to two revolutions of the hand in favor of
+   clean ones, which can be evicted without a write-back. */
+static size_t
+clock_choose (struct shard *s, struct region *r, block_sector_t sector UNUSED)
+{
+  size_t dirty_index = s->size;
+  size_t i;
+
+  for (i = 0; i < 2 * s->size; i++) {
+    size_t index = r->clock_hand;
+    r->clock_hand = (r->clock_hand + 1) % s->size;
+
+    if (bitmap_test (s->usebits, index)
+        || entry_region (s, s->entries[index]) != r)
+      continue;
+    if (bitmap_test (s->refbits, index))
+      bitmap_reset (s->refbits, index);
+    else if (!s->entries[index]->dirty)
+      return index;
+    else if (dirty_index == s->size)
+      dirty_index = index;
   }
+  return dirty_index;
+}
 
-  /* Wait for your turn to acquire entry. */
-  while (bitmap_test (usebits, e->index))
-    cond_wait (&e->queue, &cache_lock);
-  bitmap_mark (usebits, e->index);
+/* The clock hand reaches blocks in index order. */
+static size_t
+clock_victims (struct shard *s, struct region *r, struct entry **victims,
+               size_t cnt)
+{
+  size_t i, n = 0;
+  for (i = 0; n < cnt && i < s->size; i++) {
+    struct entry *e = s->entries[(r->clock_hand + i) % s->size];
+    if (e->sector != NO_SECTOR && entry_region (s, e) == r)
+      victims[n++] = e;
+  }
+  return n;
+}
 
-  *entry = e;
-  return (found != NULL);
+static bool
+clock_resize (struct shard *s UNUSED, struct region *r UNUSED)
+{
+  return true;
 }
 
-/* Just returns the sector number. The hash map automagically
-   grows its number of buckets in powers of two and masks
-   off the appropriate number of higher nibble bits. */
-unsigned
-hash_function (const struct hash_elem *e, void *aux UNUSED)
+static void
+clock_update (struct shard *s UNUSED, struct region *r UNUSED,
+              struct entry *e UNUSED)
 {
-  return hash_entry (e, struct entry, elem)->sector;
 }
 
-bool
-less_function (const struct hash_elem *a,
-               const struct hash_elem *b,
-               void *aux UNUSED)
+static const struct cache_policy clock_policy =
+  {"clock", clock_resize, clock_update, clock_update, clock_update,
+   clock_update, clock_choose, clock_victims};
+
+/* Queues and ghost lists shared by 2Q and ARC. */
+
+/* Adds E to the front of R's queue Q. */
+static void
+queue_push (struct region *r, struct entry *e, int q)
 {
-  return hash_function (a, NULL) < hash_function (b, NULL);
+  list_push_front (&r->queues[q], &e->elem);
+  e->queue_idx = q;
+  r->queue_cnt[q]++;
 }
 
-/* High-priority write-behind thread. */
+/* Moves E to the back of its queue in R, where victims are taken
+   from. */
+static void
+queue_demote (struct shard *s UNUSED, struct region *r, struct entry *e)
+{
+  list_remove (&e->elem);
+  list_push_back (&r->queues[e->queue_idx], &e->elem);
+}
+
+/* Removes E from its queue in R. */
+static void
+queue_remove (struct region *r, struct entry *e)
+{
+  list_remove (&e->elem);
+  r->queue_cnt[e->queue_idx]--;
+}
+
+/* Stores up to CNT entries from the back of R's queue Q that are
+   not in use in VICTIMS, and returns the number stored. */
+static size_t
+queue_victims (struct shard *s, struct region *r, int q,
+               struct entry **victims, size_t cnt)
+{
+  struct list_elem *elem;
+  size_t i = 0;
+
+  for (elem = list_rbegin (&r->queues[q]);
+       i < cnt && elem != list_rend (&r->queues[q]);
+       elem = list_prev (elem)) {
+    struct entry *e = list_entry (elem, struct entry, elem);
+    if (!bitmap_test (s->usebits, e->index))
+      victims[i++] = e;
+  }
+  return i;
+}
+
+/* Stores up to CNT victims in VICTIMS, taking them from the back
+   of R's queue FIRST and then from the back of the other queue,
+   and returns the number stored. */
+static size_t
+queues_victims (struct shard *s, struct region *r, int first,
+                struct entry **victims, size_t cnt)
+{
+  size_t n = queue_victims (s, r, first, victims, cnt);
+  return n + queue_victims (s, r, !first, victims + n, cnt - n);
+}
+
+/* Forgets the least recently evicted sector in R's ghost list Q. */
+static void
+ghost_drop (struct region *r, int q)
+{
+  list_push_front (&r->free_ghosts, list_pop_back (&r->ghosts[q]));
+  r->ghost_cnt[q]--;
+}
+
+/* Remembers SECTOR at the front of R's ghost list Q. If all
+   ghost records are in use, the oldest one of the other list,
+   or of Q if the other list is empty, is reused. */
+static void
+ghost_push (struct region *r, block_sector_t sector, int q)
+{
+  struct ghost *g;
+
+  if (r->ghost_pool == NULL)
+    return;
+  if (list_empty (&r->free_ghosts))
+    ghost_drop (r, r->ghost_cnt[!q] > 0 ? !q : q);
+  g = list_entry (list_pop_front (&r->free_ghosts), struct ghost, elem);
+  g->sector = sector;
+  list_push_front (&r->ghosts[q], &g->elem);
+  r->ghost_cnt[q]++;
+}
+
+/* Returns the record of SECTOR in R's ghost list Q, or a null
+   pointer if there is none. */
+static struct ghost *
+ghost_find (struct region *r, block_sector_t sector, int q)
+{
+  struct list_elem *elem;
+  for (elem = list_begin (&r->ghosts[q]); elem != list_end (&r->ghosts[q]);
+       elem = list_next (elem)) {
+    struct ghost *g = list_entry (elem, struct ghost, elem);
+    if (g->sector == sector)
+      return g;
+  }
+  return NULL;
+}
+
+/* Removes G from R's ghost list Q. */
+static void
+ghost_remove (struct region *r, struct ghost *g, int q)
+{
+  list_remove (&g->elem);
+  list_push_front (&r->free_ghosts, &g->elem);
+  r->ghost_cnt[q]--;
+}
+
+/* Forgets all ghosts of R and allocates one ghost record for
+   each cache block it is meant to hold. */
+static bool
+ghosts_resize (struct shard *s UNUSED, struct region *r)
+{
+  size_t i;
+
+  list_init (&r->ghosts[0]);
+  list_init (&r->ghosts[1]);
+  list_init (&r->free_ghosts);
+  r->ghost_cnt[0] = r->ghost_cnt[1] = 0;
+  free (r->ghost_pool);
+
+  r->ghost_pool = malloc (r->capacity * sizeof *r->ghost_pool);
+  if (r->ghost_pool == NULL)
+    return r->capacity == 0;
+  for (i = 0; i < r->capacity; i++)
+    list_push_back (&r->free_ghosts, &r->ghost_pool[i].elem);
+  if (r->target > r->capacity)
+    r->target = r->capacity;
+  return true;
+}
+
+/* 2Q policy. New sectors enter queues[0] (A1in), which is
+   managed FIFO and kept to about a quarter of the region. Sectors
+   evicted from it are remembered in ghosts[0] (A1out). Only
+   sectors that are missed again while remembered enter
+   queues[1] (Am), which is managed LRU. A single sequential
+   scan thus only churns A1in. */
+
+static void
+twoq_insert (struct shard *s UNUSED, struct region *r, struct entry *e)
+{
+  struct ghost *g = ghost_find (r, e->sector, 0);
+  if (g != NULL) {
+    ghost_remove (r, g, 0);
+    r->ghost_hits++;
+    queue_push (r, e, 1);
+  }
+  else
+    queue_push (r, e, 0);
+}
+
+static void
+twoq_access (struct shard *s UNUSED, struct region *r, struct entry *e)
+{
+  if (e->queue_idx == 1) {
+    queue_remove (r, e);
+    queue_push (r, e, 1);
+  }
+}
+
+static void
+twoq_evict (struct shard *s UNUSED, struct region *r, struct entry *e)
+{
+  queue_remove (r, e);
+  if (e->queue_idx == 0) {
+    ghost_push (r, e->sector, 0);
+    while (r->ghost_cnt[0] > r->capacity / 2)
+      ghost_drop (r, 0);
+  }
+}
+
+/* Returns the queue 2Q evicts from first. */
+static int
+twoq_first (struct region *r)
+{
+  return r->queue_cnt[0] > r->capacity / 4 || r->queue_cnt[1] == 0 ? 0 : 1;
+}
+
+static size_t
+twoq_choose (struct shard *s, struct region *r, block_sector_t sector UNUSED)
+{
+  struct entry *victim;
+  if (queues_victims (s, r, twoq_first (r), &victim, 1) == 0)
+    return s->size;
+  return victim->index;
+}
+
+static size_t
+twoq_victims (struct shard *s, struct region *r, struct entry **victims,
+              size_t cnt)
+{
+  return queues_victims (s, r, twoq_first (r), victims, cnt);
+}
+
+static const struct cache_policy twoq_policy =
+  {"2q", ghosts_resize, twoq_insert, twoq_access, twoq_evict,
+   queue_demote, twoq_choose, twoq_victims};
+
+/* ARC policy (Megiddo and Modha). queues[0] (T1) holds sectors
+   seen once recently and queues[1] (T2) sectors seen at least
+   twice, each with a ghost list of sectors recently evicted from
+   it (B1 and B2). Misses on ghosts adapt the target size of T1:
+   a miss on B1 means T1 was too small, a miss on B2 that T2
+   was. */
+
+static void
+arc_insert (struct shard *s UNUSED, struct region *r, struct entry *e)
+{
+  struct ghost *g;
+  size_t delta;
+
+  if ((g = ghost_find (r, e->sector, 0)) != NULL) {
+    delta = r->ghost_cnt[1] > r->ghost_cnt[0]
+            ? r->ghost_cnt[1] / r->ghost_cnt[0] : 1;
+    r->target = r->target + delta < r->capacity
+                ? r->target + delta : r->capacity;
+    ghost_remove (r, g, 0);
+    r->ghost_hits++;
+    queue_push (r, e, 1);
+  }
+  else if ((g = ghost_find (r, e->sector, 1)) != NULL) {
+    delta = r->ghost_cnt[0] > r->ghost_cnt[1]
+            ? r->ghost_cnt[0] / r->ghost_cnt[1] : 1;
+    r->target = r->target > delta ? r->target - delta : 0;
+    ghost_remove (r, g, 1);
+    r->ghost_hits++;
+    queue_push (r, e, 1);
+  }
+  else
+    queue_push (r, e, 0);
+}
+
+static void
+arc_access (struct shard *s UNUSED, struct region *r, struct entry *e)
+{
+  queue_remove (r, e);
+  queue_push (r, e, 1);
+}
+
+static void
+arc_evict (struct shard *s UNUSED, struct region *r, struct entry *e)
+{
+  queue_remove (r, e);
+  ghost_push (r, e->sector, e->queue_idx);
+
+  /* Keep T1 and B1 together no larger than the region. */
+  while (r->ghost_cnt[0] > 0
+         && r->queue_cnt[0] + r->ghost_cnt[0] > r->capacity)
+    ghost_drop (r, 0);
+}
+
+/* Returns the queue ARC evicts from first to make room for
+   SECTOR. */
+static int
+arc_first (struct region *r, block_sector_t sector)
+{
+  if (r->queue_cnt[0] > 0
+      && (r->queue_cnt[0] > r->target
+          || (r->queue_cnt[0] == r->target
+              && ghost_find (r, sector, 1) != NULL)))
+    return 0;
+  return 1;
+}
+
+static size_t
+arc_choose (struct shard *s, struct region *r, block_sector_t sector)
+{
+  struct entry *victim;
+  if (queues_victims (s, r, arc_first (r, sector), &victim, 1) == 0)
+    return s->size;
+  return victim->index;
+}
+
+static size_t
+arc_victims (struct shard *s, struct region *r, struct entry **victims,
+             size_t cnt)
+{
+  return queues_victims (s, r, arc_first (r, NO_SECTOR), victims, cnt);
+}
+
+static const struct cache_policy arc_policy =
+  {"arc", ghosts_resize, arc_insert, arc_access, arc_evict,
+   queue_demote, arc_choose, arc_victims};
+
+/* High-priority cleaner thread. Whenever it is woken, writes back
+   dirty entries of each shard until the next clean_watermark ()
+   cache blocks in line for eviction are clean. The victims are
+   looked up again after every write, since the shard may change
+   while its lock is released. */
 void
-write_behind_thread_func (void *aux UNUSED) {
+cleaner_thread_func (void *aux UNUSED) {
   while (true) {
-    timer_msleep (WRITE_DELAY);
-    buffer_cache_flush ();
+    sema_down (&cleaner_sema);
+    cleaner_woken = false;
+
+    size_t i, j;
+    for (i = 0; i < NUM_SHARDS; i++) {
+      struct shard *s = &shards[i];
+      struct entry *e;
+      lock_acquire (&s->lock);
+      for (j = 0; j < clean_watermark (s)
+                  && (e = next_dirty_victim (s)) != NULL; j++)
+        write_back (s, e);
+      lock_release (&s->lock);
+    }
+  }
+}
+
+/* High-priority read-ahead thread. Reads the sectors queued by
+   buffer_cache_prefetch () into the cache, skipping those that
+   are cached already. Blocks read ahead are left unreferenced,
+   so that the clock hand evicts them first if they go unused. */
+void
+read_ahead_thread_func (void *aux UNUSED) {
+  while (true) {
+    sema_down (&prefetch_sema);
+    lock_acquire (&prefetch_lock);
+    struct prefetch p = prefetch_queue[prefetch_head];
+    prefetch_head = (prefetch_head + 1) % PREFETCH_SLOTS;
+    prefetch_cnt--;
+    cond_signal (&prefetch_room, &prefetch_lock);
+    lock_release (&prefetch_lock);
+
+    block_sector_t sector = p.sector;
+    struct shard *s = sector_to_shard (sector);
+    struct entry *e;
+
+    lock_acquire (&s->lock);
+    if (lookup_entry (s, sector) != NULL) {
+      lock_release (&s->lock);
+      continue;
+    }
+    if (find_entry (s, sector, p.class, true, &e)) {
+      /* Someone else loaded SECTOR while we waited. */
+      release_entry (s, e->index, false, false);
+      lock_release (&s->lock);
+      continue;
+    }
+    s->prefetches++;
+    lock_release (&s->lock);
+
+    block_read (fs_device, sector, e->block);
+
+    lock_acquire (&s->lock);
+    release_entry (s, e->index, false, false);
+    lock_release (&s->lock);
   }
 }
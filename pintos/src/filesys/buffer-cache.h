@@ -2,24 +2,63 @@
 #define FILESYS_BUFFER_CACHE_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include "devices/block.h"
 
-/* Stats. */
-size_t cache_misses;    	/* Number of cache misses. */
-size_t cache_hits;       	/* Number of cache hits. */
+/* Initial number of cache blocks. */
+extern size_t buffer_cache_sectors;
+
+/* Replacement policy: "clock", "2q" or "arc". */
+extern const char *buffer_cache_policy;
+
+/* Shortest wait between write-behind flushes, in milliseconds. */
+#define WRITE_DELAY_MIN 1000
+
+/* Classes of cached sectors. Each class is replaced within its
+   own region of the cache, and metadata keeps a share of the
+   cache that file data cannot take over. */
+enum buffer_class
+  {
+    BUFFER_DATA,                /* File contents. */
+    BUFFER_META,                /* Inodes, indirect blocks, directories
+                                   and the free map. */
+    BUFFER_CLASS_CNT
+  };
+
+/* A sector in the buffer cache and its class. */
+struct buffer_cache_sector
+  {
+    block_sector_t sector;
+    enum buffer_class class;
+  };
 
 void buffer_cache_init (void);
+bool buffer_cache_resize (size_t sectors);
 
 /* Core interface. */
-void *buffer_cache_get (block_sector_t sector);
+void *buffer_cache_get_shared (block_sector_t sector, enum buffer_class);
+void *buffer_cache_get_exclusive (block_sector_t sector, enum buffer_class);
+void *buffer_cache_get_for_overwrite (block_sector_t sector,
+                                      enum buffer_class);
 void buffer_cache_release (void *cache_block, bool dirty);
+void buffer_cache_release_cold (void *cache_block, bool dirty);
 void buffer_cache_flush (void);
+int buffer_cache_write_delay (void);
+void buffer_cache_prefetch (block_sector_t sector, enum buffer_class,
+                           bool wait);
+void buffer_cache_demote (block_sector_t sector);
+size_t buffer_cache_hot_sectors (struct buffer_cache_sector *, size_t cnt);
 
 /* For your convenience. */
-void buffer_cache_read (block_sector_t sector, void *);
-void buffer_cache_write (block_sector_t sector, void *);
+void buffer_cache_read (block_sector_t sector, void *, enum buffer_class);
+void buffer_cache_write (block_sector_t sector, void *, enum buffer_class);
+
+/* Uncached transfers, for streaming I/O. */
+void buffer_cache_read_direct (block_sector_t sector, void *);
+void buffer_cache_write_direct (block_sector_t sector, const void *);
 
 /* Testing. */
+size_t buffer_cache_stat (int statnum);
 void buffer_cache_reset (void);
 
 #endif /* filesys/buffer-cache.h */
@@ -1,17 +1,32 @@
 #include "filesys/file.h"
 #include <debug.h>
+#include <syscall-nr.h>
 #include "filesys/inode.h"
 #include "threads/thread.h"
 #include "threads/malloc.h"
 
+/* Bounds on the read-ahead window, in sectors. */
+#define RA_MIN_SECTORS 2
+#define RA_MAX_SECTORS 16
+
 /* An open file. */
 struct file 
   {
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+    bool direct;                /* Bypass the buffer cache? */
+    int advice;                 /* Access pattern, an FADV_* value. */
+
+    /* Sequential read detection. */
+    off_t ra_next;              /* Offset a sequential read would start at. */
+    off_t ra_end;               /* End of the data already read ahead. */
+    size_t ra_window;           /* Read-ahead window in sectors, 0 if random. */
   };
 
+static void read_ahead (struct file *, off_t offset, off_t bytes_read);
+static enum inode_caching caching (struct file *);
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
@@ -24,6 +39,11 @@ file_open (struct inode *inode)
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->direct = false;
+      file->advice = FADV_NORMAL;
+      file->ra_next = 0;
+      file->ra_end = 0;
+      file->ra_window = 0;
       return file;
     }
   else
@@ -69,7 +89,7 @@ file_get_inode (struct file *file)
 off_t
 file_read (struct file *file, void *buffer, off_t size) 
 {
-  off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  off_t bytes_read = file_read_at (file, buffer, size, file->pos);
   file->pos += bytes_read;
   return bytes_read;
 }
@@ -82,7 +102,11 @@ file_read (struct file *file, void *buffer, off_t size)
 off_t
 file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs) 
 {
-  return inode_read_at (file->inode, buffer, size, file_ofs);
+  off_t bytes_read = inode_read_at_caching (file->inode, buffer, size,
+                                           file_ofs, caching (file));
+  if (!file->direct)
+    read_ahead (file, file_ofs, bytes_read);
+  return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
@@ -95,7 +119,7 @@ file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs)
 off_t
 file_write (struct file *file, const void *buffer, off_t size) 
 {
-  off_t bytes_written = inode_write_at (file->inode, buffer, size, file->pos);
+  off_t bytes_written = file_write_at (file, buffer, size, file->pos);
   file->pos += bytes_written;
   return bytes_written;
 }
@@ -111,7 +135,72 @@ off_t
 file_write_at (struct file *file, const void *buffer, off_t size,
                off_t file_ofs) 
 {
-  return inode_write_at (file->inode, buffer, size, file_ofs);
+  return inode_write_at_caching (file->inode, buffer, size, file_ofs,
+                                 caching (file));
+}
+
+/* Allocates disk space for the LENGTH bytes of FILE starting at
+   OFFSET, in as few runs of consecutive sectors as possible,
+   extending FILE if they run past its end. Returns true if
+   successful, false if the range is invalid, writes to FILE are
+   denied or the disk is full. */
+bool
+file_allocate (struct file *file, off_t offset, off_t length)
+{
+  ASSERT (file != NULL);
+  return inode_allocate (file->inode, offset, length);
+}
+
+/* Makes reads and writes of whole sectors through FILE bypass
+   the buffer cache, so that streaming through FILE does not
+   evict other data. Partial sectors are still cached, and so
+   are sectors of FILE that were cached already. */
+void
+file_set_direct (struct file *file)
+{
+  ASSERT (file != NULL);
+  file->direct = true;
+}
+
+/* Tells the buffer cache how the LENGTH bytes of FILE starting at
+   OFFSET will be used, ADVICE being one of the FADV_* values in
+   <syscall-nr.h>. A LENGTH of 0 extends to the end of FILE.
+   FADV_WILLNEED reads the bytes ahead in the background and
+   FADV_DONTNEED makes them the first to be evicted. The other
+   values set the access pattern of all of FILE. Returns false if
+   ADVICE or the range is invalid. */
+bool
+file_advise (struct file *file, off_t offset, off_t length, int advice)
+{
+  ASSERT (file != NULL);
+
+  if (offset < 0 || length < 0)
+    return false;
+  if (length == 0)
+    length = file_length (file) - offset;
+
+  switch (advice)
+    {
+    case FADV_NORMAL:
+    case FADV_RANDOM:
+    case FADV_NOREUSE:
+      file->advice = advice;
+      file->ra_window = 0;
+      break;
+    case FADV_SEQUENTIAL:
+      file->advice = advice;
+      file->ra_window = RA_MAX_SECTORS;
+      break;
+    case FADV_WILLNEED:
+      inode_read_ahead (file->inode, offset, length);
+      break;
+    case FADV_DONTNEED:
+      inode_demote (file->inode, offset, length);
+      break;
+    default:
+      return false;
+    }
+  return true;
 }
 
 /* Prevents write operations on FILE's underlying inode
@@ -181,3 +270,52 @@ file_isdir (struct file *file)
 {
   return inode_isdir (file->inode);
 }
+
+/* Updates FILE's read-ahead state after BYTES_READ bytes were
+   read starting at OFFSET. A read that picks up where the last
+   one left off doubles the read-ahead window, up to
+   RA_MAX_SECTORS, and asks the buffer cache to prefetch the part
+   of the window that has not been read ahead yet. Any other read
+   collapses the window, unless FILE was advised to be read
+   sequentially. Files advised to be read randomly are never read
+   ahead. */
+static void
+read_ahead (struct file *file, off_t offset, off_t bytes_read)
+{
+  if (bytes_read <= 0 || file->advice == FADV_RANDOM)
+    return;
+
+  if (offset != file->ra_next)
+    {
+      file->ra_window = file->advice == FADV_SEQUENTIAL ? RA_MAX_SECTORS : 0;
+      file->ra_end = 0;
+    }
+  else if (file->ra_window == 0)
+    file->ra_window = RA_MIN_SECTORS;
+  else if (file->ra_window < RA_MAX_SECTORS)
+    file->ra_window *= 2;
+  file->ra_next = offset + bytes_read;
+
+  if (file->ra_window > 0)
+    {
+      off_t start = (file->ra_end > file->ra_next
+                     ? file->ra_end : file->ra_next);
+      off_t end = file->ra_next + file->ra_window * BLOCK_SECTOR_SIZE;
+      if (start < end)
+        {
+          inode_read_ahead (file->inode, start, end - start);
+          file->ra_end = end;
+        }
+    }
+}
+
+/* Returns how reads and writes through FILE are cached. */
+static enum inode_caching
+caching (struct file *file)
+{
+  if (file->direct)
+    return INODE_DIRECT;
+  if (file->advice == FADV_NOREUSE)
+    return INODE_NOREUSE;
+  return INODE_CACHED;
+}
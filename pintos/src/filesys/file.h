@@ -18,6 +18,13 @@ off_t file_read_at (struct file *, void *, off_t size, off_t start);
 off_t file_write (struct file *, const void *, off_t);
 off_t file_write_at (struct file *, const void *, off_t size, off_t start);
 
+/* Bypassing the buffer cache. */
+void file_set_direct (struct file *);
+bool file_advise (struct file *, off_t offset, off_t length, int advice);
+
+/* Allocating space ahead of writes. */
+bool file_allocate (struct file *, off_t offset, off_t length);
+
 /* Preventing writes. */
 void file_deny_write (struct file *);
 void file_allow_write (struct file *);
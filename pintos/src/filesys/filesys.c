@@ -2,17 +2,23 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include <syscall-nr.h>
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
 #include "filesys/buffer-cache.h"
+#include "threads/malloc.h"
 #include "threads/thread.h"
+#include "devices/timer.h"
 
 /* Partition that contains the file system. */
 struct block *fs_device;
 
 static void do_format (void);
+static void load_hot_list (void);
+static void save_hot_list (void);
+static void write_behind_thread_func (void *aux);
 static bool follow_path (const char *path, struct dir **, char filename[NAME_MAX +1]);
 static int get_next_part (char part[NAME_MAX + 1], const char **srcp);
 
@@ -33,8 +39,14 @@ filesys_init (bool format)
     do_format ();
 
   free_map_open ();
+  load_hot_list ();
+  thread_create ("write-behind", PRI_MAX, write_behind_thread_func, NULL);
 
   thread_current ()->cwd = inode_open (ROOT_DIR_SECTOR);
+
+  /* New files take the format of the file system. */
+  if (!format)
+    inode_use_extents = inode_has_extents (thread_current ()->cwd);
 }
 
 /* Shuts down the file system module, writing any unwritten data
@@ -42,10 +54,24 @@ filesys_init (bool format)
 void
 filesys_done (void) 
 {
+  inode_done ();
+  save_hot_list ();
   free_map_close ();
   buffer_cache_flush ();
 }
 
+/* Writes the delayed data blocks of open files, then the changed
+   parts of the free map, then the dirty blocks of the buffer
+   cache, so that the blocks allocated for the first are recorded
+   in the second and both reach the disk with the third. */
+void
+filesys_flush (void)
+{
+  inode_flush ();
+  free_map_flush ();
+  buffer_cache_flush ();
+}
+
 /* Creates a file named NAME with the given INITIAL_SIZE.
    Returns true if successful, false otherwise.
    Fails if a file named NAME already exists,
@@ -133,10 +159,104 @@ do_format (void)
   free_map_create ();
   if (!dir_create (ROOT_DIR_SECTOR, 16))
     PANIC ("root directory creation failed");
+  if (!inode_create (HOT_LIST_SECTOR, 0, false))
+    PANIC ("hot sector list creation failed");
   free_map_close ();
   printf ("done.\n");
 }
 
+/* The hot sector list file starts with a struct hot_list_header,
+   followed by a struct buffer_cache_sector for each sector in the
+   buffer cache at the last shutdown. */
+#define HOT_LIST_MAGIC 0x484f544c       /* "HOTL". */
+#define HOT_LIST_VERSION 1
+
+struct hot_list_header
+  {
+    uint32_t magic;                     /* HOT_LIST_MAGIC. */
+    uint32_t version;                   /* HOT_LIST_VERSION. */
+    uint32_t cnt;                       /* Number of sectors. */
+  };
+
+/* Queues the sectors in the hot sector list to be read into the
+   buffer cache in the background, so that the first programs
+   run after a reboot find them cached. The list may be longer
+   than the read-ahead queue, so this waits for room in it
+   rather than dropping the rest of the list. Does nothing if
+   HOT_LIST_SECTOR or the list in it was not written by this
+   version of the file system. */
+static void
+load_hot_list (void)
+{
+  struct hot_list_header h;
+  struct buffer_cache_sector hot;
+  struct file *file;
+  size_t loaded = 0;
+  uint32_t i;
+
+  if (!inode_valid (HOT_LIST_SECTOR))
+    return;
+  file = file_open (inode_open (HOT_LIST_SECTOR));
+  if (file == NULL)
+    return;
+  if (file_read_at (file, &h, sizeof h, 0) == sizeof h
+      && h.magic == HOT_LIST_MAGIC && h.version == HOT_LIST_VERSION
+      && h.cnt <= block_size (fs_device)) {
+    printf ("Loading hot sectors...");
+    for (i = 0; i < h.cnt; i++) {
+      off_t ofs = sizeof h + i * sizeof hot;
+      if (file_read_at (file, &hot, sizeof hot, ofs) != sizeof hot)
+        break;
+      if (hot.sector < block_size (fs_device)
+          && hot.class < BUFFER_CLASS_CNT) {
+        buffer_cache_prefetch (hot.sector, hot.class, true);
+        loaded++;
+      }
+    }
+    printf ("%zu queued.\n", loaded);
+  }
+  file_close (file);
+}
+
+/* Records the sectors in the buffer cache in the hot sector
+   list. */
+static void
+save_hot_list (void)
+{
+  size_t size = buffer_cache_stat (BUFFER_STAT_SIZE);
+  struct buffer_cache_sector *hot = malloc (size * sizeof *hot);
+  struct file *file = file_open (inode_open (HOT_LIST_SECTOR));
+
+  if (hot != NULL && file != NULL) {
+    struct hot_list_header h;
+    h.magic = HOT_LIST_MAGIC;
+    h.version = HOT_LIST_VERSION;
+    h.cnt = buffer_cache_hot_sectors (hot, size);
+    file_write_at (file, &h, sizeof h, 0);
+    file_write_at (file, hot, h.cnt * sizeof *hot, sizeof h);
+  }
+  file_close (file);
+  free (hot);
+}
+
+/* High-priority write-behind thread. Checks the share of dirty
+   cache blocks every WRITE_DELAY_MIN ms and flushes the file
+   system once buffer_cache_write_delay () ms have passed since
+   the last flush. */
+static void
+write_behind_thread_func (void *aux UNUSED)
+{
+  int waited = 0;
+  while (true) {
+    timer_msleep (WRITE_DELAY_MIN);
+    waited += WRITE_DELAY_MIN;
+    if (waited >= buffer_cache_write_delay ()) {
+      filesys_flush ();
+      waited = 0;
+    }
+  }
+}
+
 /* Stores the name of the file referenced by PATH in
    FILENAME, and the directory in DIR. If the file is
    a directory, FILENAME is set to ".".
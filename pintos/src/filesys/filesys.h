@@ -8,12 +8,14 @@
 /* Sectors of system file inodes. */
 #define FREE_MAP_SECTOR 0       /* Free map file inode sector. */
 #define ROOT_DIR_SECTOR 1       /* Root directory file inode sector. */
+#define HOT_LIST_SECTOR 2       /* Hot sector list file inode sector. */
 
 /* Block device that contains the file system. */
 struct block *fs_device;
 
 void filesys_init (bool format);
 void filesys_done (void);
+void filesys_flush (void);
 bool filesys_create (const char *name, off_t initial_size, bool is_dir);
 struct file *filesys_open (const char *name);
 bool filesys_remove (const char *name);
@@ -1,31 +1,239 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <string.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/malloc.h"
 #include "threads/synch.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static size_t reserved;              /* Free sectors set aside for later. */
+static struct bitmap *dirty;         /* Changed sectors of the free map file. */
+static size_t deferred;              /* Sectors to be freed in the background. */
+static struct condition freed;       /* Signaled as deferred sectors are freed. */
+
+/* A run of free sectors this long is good enough to start an
+   extent in, even if it is shorter than the extent wanted. Keeps
+   the search for free runs short. */
+#define EXTENT_RUN_MIN 64
 
 /* We maintain a lock to synchronize free map operations that
    can also be acquired from the outside. If the lock is already
-   held by the current thread, we ignore it. See macros below. */
-
-static bool ignore_lock;
+   held by the current thread, we ignore it. Whether it was is
+   kept in a local variable that acquire_lock () declares, since
+   other threads take the lock while its holder waits for space.
+   See macros below. */
 
-#define acquire_lock(LOCK) do {                                 \
-  ignore_lock = lock_held_by_current_thread (LOCK);             \
+#define acquire_lock(LOCK)                                      \
+  bool ignore_lock = lock_held_by_current_thread (LOCK);        \
   if (!ignore_lock)                                             \
-    lock_acquire (LOCK);                                        \
-} while (0)
+    lock_acquire (LOCK)
 
 #define release_lock(LOCK) do {                                 \
   if (!ignore_lock)                                             \
     lock_release (LOCK);                                        \
 } while (0)
 
+/* Number of free map bits held by a sector of the free map
+   file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
+
+/* Marks the sectors of the free map file holding the CNT bits
+   starting at START as changed, to be written by
+   free_map_flush (). Must be called with free_map_lock held. */
+static void
+mark_dirty (size_t start, size_t cnt)
+{
+  size_t first = start / BITS_PER_SECTOR;
+  size_t last = (start + cnt - 1) / BITS_PER_SECTOR;
+  bitmap_set_multiple (dirty, first, last - first + 1, true);
+}
+
+/* Index of the free sectors in the free map, so that searching
+   it takes time logarithmic in the size of the device. The free
+   map is divided into groups of GROUP_SECTORS sectors, which are
+   the leaves of a segment tree. Each node of the tree summarizes
+   the sectors of its leaves. */
+#define GROUP_SECTORS 64
+
+struct summary
+  {
+    uint32_t free;                  /* Number of free sectors. */
+    uint32_t head;                  /* Free sectors at the start. */
+    uint32_t tail;                  /* Free sectors at the end. */
+    uint32_t run;                   /* Longest run of free sectors. */
+    uint32_t cnt;                   /* Number of sectors. */
+  };
+
+/* Node 1 is the root, and node I has children 2 * I and
+   2 * I + 1. The LEAF_CNT leaves follow the other nodes, the last
+   ones covering no sectors. */
+static struct summary *tree;
+static size_t leaf_cnt;
+
+/* Summarizes group GROUP of the free map in its leaf. */
+static void
+summarize_group (size_t group)
+{
+  struct summary *leaf = &tree[leaf_cnt + group];
+  size_t start = group * GROUP_SECTORS;
+  size_t size = bitmap_size (free_map);
+  size_t i, run = 0;
+
+  memset (leaf, 0, sizeof *leaf);
+  if (start < size)
+    leaf->cnt = size - start < GROUP_SECTORS ? size - start : GROUP_SECTORS;
+  for (i = 0; i < leaf->cnt; i++)
+    if (!bitmap_test (free_map, start + i)) {
+      leaf->free++;
+      if (++run > leaf->run)
+        leaf->run = run;
+      if (leaf->head == i)
+        leaf->head++;
+    }
+    else
+      run = 0;
+  leaf->tail = run;
+}
+
+/* Summarizes node I of the tree from its children. */
+static void
+summarize_node (size_t i)
+{
+  const struct summary *l = &tree[2 * i];
+  const struct summary *r = &tree[2 * i + 1];
+  struct summary *n = &tree[i];
+
+  n->free = l->free + r->free;
+  n->cnt = l->cnt + r->cnt;
+  n->head = l->head == l->cnt ? l->cnt + r->head : l->head;
+  n->tail = r->tail == r->cnt ? r->cnt + l->tail : r->tail;
+  n->run = l->tail + r->head;
+  if (l->run > n->run)
+    n->run = l->run;
+  if (r->run > n->run)
+    n->run = r->run;
+}
+
+/* Builds the tree from scratch. */
+static void
+build_tree (void)
+{
+  size_t i;
+  for (i = 0; i < leaf_cnt; i++)
+    summarize_group (i);
+  for (i = leaf_cnt - 1; i > 0; i--)
+    summarize_node (i);
+}
+
+/* Sets the CNT bits of the free map starting at START to VALUE,
+   keeping the tree up to date and marking the changed sectors of
+   the free map file. Must be called with free_map_lock held. */
+static void
+set_sectors (size_t start, size_t cnt, bool value)
+{
+  size_t group;
+
+  if (cnt == 0)
+    return;
+  bitmap_set_multiple (free_map, start, cnt, value);
+  mark_dirty (start, cnt);
+  for (group = start / GROUP_SECTORS;
+       group <= (start + cnt - 1) / GROUP_SECTORS; group++) {
+    size_t i = leaf_cnt + group;
+    summarize_group (group);
+    while ((i /= 2) > 0)
+      summarize_node (i);
+  }
+}
+
+/* Returns the first free sector at or after START, or
+   BITMAP_ERROR if there is none. Must be called with
+   free_map_lock held. */
+static size_t
+find_free (size_t start)
+{
+  size_t size = bitmap_size (free_map);
+  size_t i;
+
+  if (start >= size)
+    return BITMAP_ERROR;
+
+  /* Search the rest of START's group first. */
+  for (i = start; i < ROUND_UP (start + 1, GROUP_SECTORS) && i < size; i++)
+    if (!bitmap_test (free_map, i))
+      return i;
+
+  /* Climb until a right sibling with a free sector turns up, then
+     descend to its leftmost leaf with one. */
+  i = leaf_cnt + start / GROUP_SECTORS;
+  while (i > 1 && (i % 2 == 1 || tree[i + 1].free == 0))
+    i /= 2;
+  if (i == 1)
+    return BITMAP_ERROR;
+  for (i++; i < leaf_cnt; )
+    i = tree[2 * i].free > 0 ? 2 * i : 2 * i + 1;
+
+  for (start = (i - leaf_cnt) * GROUP_SECTORS; ; start++)
+    if (!bitmap_test (free_map, start))
+      return start;
+}
+
+/* Returns the first sector of the first run of CNT free sectors,
+   or BITMAP_ERROR if there is none. CNT must not be 0. Must be
+   called with free_map_lock held. */
+static size_t
+find_run (size_t cnt)
+{
+  size_t i = 1;
+  size_t start = 0;
+
+  ASSERT (cnt > 0);
+  if (tree[1].run < cnt)
+    return BITMAP_ERROR;
+  while (i < leaf_cnt) {
+    const struct summary *l = &tree[2 * i];
+    const struct summary *r = &tree[2 * i + 1];
+    if (l->run >= cnt)
+      i = 2 * i;
+    else if (l->tail + r->head >= cnt)
+      return start + l->cnt - l->tail;
+    else {
+      start += l->cnt;
+      i = 2 * i + 1;
+    }
+  }
+  return bitmap_scan (free_map, start, cnt, false);
+}
+
+/* Returns the number of free sectors that are not reserved.
+   Must be called with free_map_lock held. */
+static size_t
+unreserved_space (void)
+{
+  return tree[1].free - reserved;
+}
+
+/* Returns true if at least CNT free sectors are not reserved,
+   waiting for deferred sectors to be freed as long as that may
+   make enough of them available. Must be called with
+   free_map_lock held, which is released while waiting. */
+static bool
+wait_for_space (size_t cnt)
+{
+  while (unreserved_space () < cnt) {
+    if (unreserved_space () + deferred < cnt)
+      return false;
+    cond_wait (&freed, &free_map_lock);
+  }
+  return true;
+}
+
 /* Initializes the free map. */
 void
 free_map_init (void)
@@ -35,27 +243,37 @@ free_map_init (void)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  bitmap_mark (free_map, HOT_LIST_SECTOR);
+
+  size_t groups = DIV_ROUND_UP (bitmap_size (free_map), GROUP_SECTORS);
+  for (leaf_cnt = 1; leaf_cnt < groups; leaf_cnt *= 2)
+    continue;
+  tree = calloc (2 * leaf_cnt, sizeof *tree);
+  if (tree == NULL)
+    PANIC ("free map index creation failed--file system device is too large");
+  build_tree ();
+
+  dirty = bitmap_create (DIV_ROUND_UP (bitmap_file_size (free_map),
+                                       BLOCK_SECTOR_SIZE));
+  if (dirty == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
   lock_init (&free_map_lock);
+  cond_init (&freed);
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
   acquire_lock (&free_map_lock);
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
-    {
-      bitmap_set_multiple (free_map, sector, cnt, false);
-      sector = BITMAP_ERROR;
-    }
+  block_sector_t sector = BITMAP_ERROR;
+  if (wait_for_space (cnt))
+    sector = find_run (cnt);
+  if (sector != BITMAP_ERROR)
+    set_sectors (sector, cnt, true);
   release_lock (&free_map_lock);
   if (sector != BITMAP_ERROR)
     *sectorp = sector;
@@ -68,8 +286,7 @@ free_map_release (block_sector_t sector, size_t cnt)
 {
   ASSERT (bitmap_all (free_map, sector, cnt));
   acquire_lock (&free_map_lock);
-  bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  set_sectors (sector, cnt, false);
   release_lock (&free_map_lock);
 }
 
@@ -82,33 +299,118 @@ free_map_allocate_nc (size_t cnt, block_sector_t *sectors)
 {
   bool success = false;
   acquire_lock (&free_map_lock);
-  if (bitmap_count (free_map, 0, block_size (fs_device), false) >= cnt) {
+  if (wait_for_space (cnt)) {
     size_t i = 0;
     size_t pos = 0;
     for (; i < cnt; i++) {
-      pos = bitmap_scan_and_flip (free_map, pos, 1, false);
+      pos = find_free (pos);
+      set_sectors (pos, 1, true);
       sectors[i] = pos++;
     }
-    if (free_map_file != NULL)
-      bitmap_write (free_map, free_map_file);
     success = true;
   }
   release_lock (&free_map_lock);
   return success;
 }
 
-/* Makes the first CNT sectors in SECTORS available for use. */
+/* Allocates up to CNT consecutive sectors from the free map,
+   preferring the sectors starting at GOAL, then the first run of
+   CNT or EXTENT_RUN_MIN free sectors, whichever is less, then
+   the first free sector after GOAL, then the first free sector.
+   Stores the first sector into *SECTORP.
+   Returns the number of sectors allocated, which is 0 only if no
+   sectors are available. */
+size_t
+free_map_allocate_extent (size_t cnt, block_sector_t goal,
+                          block_sector_t *sectorp)
+{
+  size_t size = bitmap_size (free_map);
+  size_t sector;
+  size_t n = 0;
+
+  acquire_lock (&free_map_lock);
+  wait_for_space (1);
+  if (cnt > unreserved_space ())
+    cnt = unreserved_space ();
+  if (cnt == 0)
+    sector = BITMAP_ERROR;
+  else if (goal < size && !bitmap_test (free_map, goal))
+    sector = goal;
+  else {
+    sector = find_run (cnt < EXTENT_RUN_MIN ? cnt : EXTENT_RUN_MIN);
+    if (sector == BITMAP_ERROR)
+      sector = find_free (goal);
+    if (sector == BITMAP_ERROR)
+      sector = find_free (0);
+  }
+
+  if (sector != BITMAP_ERROR) {
+    while (n < cnt && sector + n < size && !bitmap_test (free_map, sector + n))
+      n++;
+    set_sectors (sector, n, true);
+    *sectorp = sector;
+  }
+  release_lock (&free_map_lock);
+  return n;
+}
+
+/* Allocates up to CNT consecutive sectors from the free map, so
+   that a file can be given CNT sectors in as few runs as
+   possible. Takes the run of CNT free sectors starting at GOAL if
+   there is one, then the first run of CNT free sectors, then the
+   longest run of free sectors there is. Stores the first sector
+   into *SECTORP. Returns the number of sectors allocated, which
+   is 0 only if no sectors are available. */
+size_t
+free_map_allocate_run (size_t cnt, block_sector_t goal,
+                       block_sector_t *sectorp)
+{
+  size_t size = bitmap_size (free_map);
+  size_t sector;
+  size_t n = 0;
+
+  acquire_lock (&free_map_lock);
+  wait_for_space (1);
+  if (cnt > unreserved_space ())
+    cnt = unreserved_space ();
+  if (cnt == 0)
+    sector = BITMAP_ERROR;
+  else if (goal < size && cnt <= size - goal
+           && bitmap_none (free_map, goal, cnt))
+    sector = goal;
+  else
+    sector = find_run (cnt);
+
+  /* Settle for the longest run there is. */
+  if (sector != BITMAP_ERROR)
+    n = cnt;
+  else if (cnt > 0) {
+    n = tree[1].run;
+    sector = find_run (n);
+  }
+
+  if (sector != BITMAP_ERROR) {
+    set_sectors (sector, n, true);
+    *sectorp = sector;
+  }
+  release_lock (&free_map_lock);
+  return n;
+}
+
+/* Makes the first CNT sectors in SECTORS available for use.
+   Entries that are 0 stand for no sector and are skipped. */
 void
 free_map_release_nc (block_sector_t *sectors, size_t cnt)
 {
   acquire_lock (&free_map_lock);
   size_t i = 0;
   for (; i < cnt; i++) {
+    if (sectors[i] == 0)
+      continue;
     ASSERT (bitmap_test (free_map, sectors[i]));
-    bitmap_reset (free_map, sectors[i]);
+    set_sectors (sectors[i], 1, false);
     sectors[i] = 0;
   }
-  bitmap_write (free_map, free_map_file);
   release_lock (&free_map_lock);
 }
 
@@ -122,6 +424,26 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  build_tree ();
+  bitmap_set_all (dirty, false);
+  release_lock (&free_map_lock);
+}
+
+/* Writes the sectors of the free map file whose part of the free
+   map changed since they were last written. Called at
+   write-behind time, so that allocations and releases in between
+   write each sector of the free map file only once. */
+void
+free_map_flush (void)
+{
+  acquire_lock (&free_map_lock);
+  if (free_map_file != NULL) {
+    size_t i = 0;
+    while ((i = bitmap_scan_and_flip (dirty, i, 1, true)) != BITMAP_ERROR)
+      if (!bitmap_write_part (free_map, free_map_file, i * BLOCK_SECTOR_SIZE,
+                              BLOCK_SECTOR_SIZE))
+        PANIC ("can't write free map");
+  }
   release_lock (&free_map_lock);
 }
 
@@ -129,8 +451,10 @@ free_map_open (void)
 void
 free_map_close (void)
 {
+  free_map_flush ();
   acquire_lock (&free_map_lock);
   file_close (free_map_file);
+  free_map_file = NULL;
   release_lock (&free_map_lock);
 }
 
@@ -151,16 +475,77 @@ free_map_create (void)
     PANIC ("can't open free map");
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+  bitmap_set_all (dirty, false);
 
   release_lock (&free_map_lock);
 }
 
-/* Returns the number of sectors available for use. */
+/* Returns the number of sectors available for use, not counting
+   reserved ones, but counting deferred ones. */
 size_t
 free_map_available_space (void)
 {
   acquire_lock (&free_map_lock);
-  size_t space = bitmap_count (free_map, 0, block_size (fs_device), false);
+  size_t space = unreserved_space () + deferred;
   release_lock (&free_map_lock);
   return space;
 }
+
+/* Sets aside CNT free sectors, which no allocation may use until
+   they are released with free_map_unreserve (). Returns true if
+   successful, false if not enough sectors are available. */
+bool
+free_map_reserve (size_t cnt)
+{
+  acquire_lock (&free_map_lock);
+  bool success = wait_for_space (cnt);
+  if (success)
+    reserved += cnt;
+  release_lock (&free_map_lock);
+  return success;
+}
+
+/* Releases CNT sectors reserved with free_map_reserve (). */
+void
+free_map_unreserve (size_t cnt)
+{
+  acquire_lock (&free_map_lock);
+  ASSERT (reserved >= cnt);
+  reserved -= cnt;
+  release_lock (&free_map_lock);
+}
+
+/* Waits until at least CNT free sectors are not reserved, as long
+   as deferred sectors may make enough of them available. Returns
+   true if successful, false if not enough sectors are available.
+   Must be called with free_map_lock held. */
+bool
+free_map_wait_for_space (size_t cnt)
+{
+  ASSERT (lock_held_by_current_thread (&free_map_lock));
+  return wait_for_space (cnt);
+}
+
+/* Counts CNT sectors that are to be freed in the background as
+   available, so that allocations wait for them to be freed
+   instead of failing. */
+void
+free_map_defer (size_t cnt)
+{
+  acquire_lock (&free_map_lock);
+  deferred += cnt;
+  release_lock (&free_map_lock);
+}
+
+/* Stops counting CNT sectors passed to free_map_defer (), once
+   they have been freed, and wakes up allocations waiting for
+   them. */
+void
+free_map_undefer (size_t cnt)
+{
+  acquire_lock (&free_map_lock);
+  ASSERT (deferred >= cnt);
+  deferred -= cnt;
+  cond_broadcast (&freed, &free_map_lock);
+  release_lock (&free_map_lock);
+}
@@ -13,13 +13,21 @@ void free_map_read (void);
 void free_map_create (void);
 void free_map_open (void);
 void free_map_close (void);
+void free_map_flush (void);
 
 bool free_map_allocate (size_t, block_sector_t *);
 void free_map_release (block_sector_t, size_t);
 
 bool free_map_allocate_nc (size_t, block_sector_t *);
+size_t free_map_allocate_extent (size_t, block_sector_t, block_sector_t *);
+size_t free_map_allocate_run (size_t, block_sector_t, block_sector_t *);
 void free_map_release_nc (block_sector_t *, size_t);
 
 size_t free_map_available_space (void);
+bool free_map_reserve (size_t);
+void free_map_unreserve (size_t);
+bool free_map_wait_for_space (size_t);
+void free_map_defer (size_t);
+void free_map_undefer (size_t);
 
 #endif /* filesys/free-map.h */
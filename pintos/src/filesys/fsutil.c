@@ -1,15 +1,19 @@
 #include "filesys/fsutil.h"
 #include <debug.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <syscall-nr.h>
 #include <ustar.h>
+#include "filesys/buffer-cache.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/vaddr.h"
+#include "devices/timer.h"
 
 /* List files in the root directory. */
 void
@@ -220,3 +224,68 @@ fsutil_append (char **argv)
   file_close (src);
   free (buffer);
 }
+
+/* Number of sectors the spread pass of cache-bench cycles
+   through, so that its hits land on every shard. */
+#define BENCH_SPREAD 32
+
+/* Times COUNT get/release pairs on the first SPREAD sectors of
+   the file system device in turn, locking them exclusively if
+   EXCLUSIVE, and prints the time per hit along with the number
+   of misses taken, which should be 0. */
+static void
+time_cache_hits (const char *name, int count, block_sector_t spread,
+                 bool exclusive)
+{
+  size_t misses;
+  int64_t start, ns;
+  int i;
+
+  for (i = 0; i < (int) spread; i++)
+    buffer_cache_release (buffer_cache_get_shared (i, BUFFER_META), false);
+
+  misses = buffer_cache_stat (BUFFER_STAT_MISSES);
+  start = timer_ticks ();
+  for (i = 0; i < count; i++) {
+    block_sector_t sector = i % spread;
+    void *block = (exclusive
+                   ? buffer_cache_get_exclusive (sector, BUFFER_META)
+                   : buffer_cache_get_shared (sector, BUFFER_META));
+    buffer_cache_release (block, false);
+  }
+  ns = timer_elapsed (start) * (1000000000 / TIMER_FREQ);
+  printf ("%s: %"PRId64" ns/hit, %zu misses\n", name,
+          count > 0 ? ns / count : 0,
+          buffer_cache_stat (BUFFER_STAT_MISSES) - misses);
+}
+
+/* Microbenchmark for the buffer cache hit path: locks and
+   releases a sector ARGV[1] times in each lock mode, first
+   always the same one and then BENCH_SPREAD of them in turn.
+   The policy and size in effect are printed first, so that runs
+   with different -cache-policy and -cache options can be
+   compared. */
+void
+fsutil_cache_bench (char **argv)
+{
+  int count = atoi (argv[1]);
+  block_sector_t spread = BENCH_SPREAD;
+
+  if (spread > block_size (fs_device))
+    spread = block_size (fs_device);
+  if (spread > buffer_cache_stat (BUFFER_STAT_SIZE) / 2)
+    spread = buffer_cache_stat (BUFFER_STAT_SIZE) / 2;
+  if (spread == 0)
+    spread = 1;
+
+  printf ("Timing %d buffer cache hits per pass "
+          "(policy %s, %zu shards, %zu sectors)...\n",
+          count, buffer_cache_policy,
+          buffer_cache_stat (BUFFER_STAT_SHARDS),
+          buffer_cache_stat (BUFFER_STAT_SIZE));
+  time_cache_hits ("shared, 1 sector", count, 1, false);
+  time_cache_hits ("exclusive, 1 sector", count, 1, true);
+  printf ("spread over %"PRDSNu" sectors:\n", spread);
+  time_cache_hits ("shared", count, spread, false);
+  time_cache_hits ("exclusive", count, spread, true);
+}
@@ -1,6 +1,7 @@
 #include "filesys/inode.h"
-#include <list.h>
+#include <hash.h>
 #include <debug.h>
+#include <list.h>
 #include <round.h>
 #include <string.h>
 #include "filesys/buffer-cache.h"
@@ -13,18 +14,87 @@
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Identifies an inode whose data blocks are mapped by extents. */
+#define EXTENT_MAGIC 0x494e4f45
+
 #define NUM_DIRECT 119
 #define NUM_INDIRECT 128
 #define MAX_LENGTH 8388608
 
+/* Number of bytes of data an inode can hold in place of its
+   pointers, for files that small. */
+#define INLINE_SIZE ((NUM_DIRECT + 2) * sizeof (block_sector_t))
+
+/* Number of entries in the root of an extent tree, and in the
+   other nodes of an extent tree. */
+#define ROOT_EXTENTS 39
+#define BLOCK_EXTENTS 42
+
+/* Number of levels of index nodes an extent tree may need, which
+   bounds the number of nodes a single extension can add beyond
+   the leaves it fills. */
+#define MAX_DEPTH 3
+
+/* Entry of an extent tree. In a leaf, maps CNT data blocks
+   starting at index START to the sectors starting at SECTOR. In
+   an index node, SECTOR holds the child node whose first entry
+   starts at START, and CNT is unused. */
+struct disk_extent
+  {
+    uint32_t start;                       /* Index of first data block. */
+    block_sector_t sector;                /* Sector of first data block. */
+    uint32_t cnt;                         /* Number of data blocks. */
+  };
+
+/* Sectors set aside for the nodes that inserting an extent adds
+   to an extent tree: one for each level of nodes that splits,
+   and one more for the root. */
+struct node_pool
+  {
+    block_sector_t sectors[MAX_DEPTH + 2];
+    size_t cnt;
+  };
+
+/* Header of a node of an extent tree. */
+struct extent_header
+  {
+    uint32_t cnt;                         /* Number of entries. */
+    uint32_t depth;                       /* 0 for a leaf. */
+  };
+
+/* Node of an extent tree other than the root.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct extent_block
+  {
+    struct extent_header header;
+    struct disk_extent entries[BLOCK_EXTENTS];
+    uint8_t unused[8];
+  };
+
 /* On-disk inode.
    Must be exactly BLOCK_SECTOR_SIZE bytes long. */
 struct inode_disk
   {
-    /* Data blocks. */
-    block_sector_t direct[NUM_DIRECT];    /* Direct pointers. */
-    block_sector_t indirect;              /* Indirect pointer. */
-    block_sector_t doubly_indirect;       /* Doubly indirect pointer. */
+    /* Data blocks, mapped by pointers if MAGIC is INODE_MAGIC and
+       by extents if MAGIC is EXTENT_MAGIC. Data blocks that were
+       never written are holes, with no sector: pointer 0, or no
+       extent. If INLINED is true, the data itself is held in DATA
+       instead, zero-padded, and there are no data blocks. */
+    union
+      {
+        uint8_t data[INLINE_SIZE];            /* Inline data. */
+        struct
+          {
+            block_sector_t direct[NUM_DIRECT];    /* Direct pointers. */
+            block_sector_t indirect;              /* Indirect pointer. */
+            block_sector_t doubly_indirect;       /* Doubly indirect pointer. */
+          };
+        struct
+          {
+            struct extent_header extent_root;     /* Root of extent tree. */
+            struct disk_extent extents[ROOT_EXTENTS];
+          };
+      };
 
     /* Filesys metadata. */
     block_sector_t parent;                /* inode_disk sector of the parent directory. */
@@ -35,9 +105,22 @@ struct inode_disk
     /* Misc. */
     off_t length;                         /* File size in bytes. */
     unsigned magic;                       /* Note: magic has a different offset now. */
-    uint8_t unused[3];
+    bool inlined;                         /* True if data is held in DATA. */
+    uint8_t unused[2];
   };
 
+/* True if inodes created from now on map their data blocks with
+   extents. Set by kernel command-line option "-f=extents", and
+   otherwise to the format of the root directory. */
+bool inode_use_extents;
+
+/* Returns true if DISK_INODE maps its data blocks with extents. */
+static inline bool
+has_extents (const struct inode_disk *disk_inode)
+{
+  return disk_inode->magic == EXTENT_MAGIC;
+}
+
 /* Returns the number of sectors to allocate for an inode SIZE
    bytes long. */
 static inline size_t
@@ -46,14 +129,74 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
+/* Number of extents cached per inode. */
+#define EXTENT_CNT 16
+
+/* Largest number of extents cached on a single miss. Less than
+   EXTENT_CNT, so that a miss never evicts the extent it loads. */
+#define EXTENT_FILL (EXTENT_CNT / 2)
+
+/* Maximum number of data blocks of an inode whose allocation is
+   delayed. */
+#define DELAY_CNT 64
+
+/* A run of data blocks of an inode that are consecutive on
+   disk. */
+struct extent
+  {
+    size_t start;                       /* Index of first data block. */
+    block_sector_t sector;              /* Sector of first data block. */
+    size_t cnt;                         /* Number of data blocks. */
+  };
+
 /* In-memory inode. */
 struct inode
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open_inodes. */
+    struct list_elem reclaim_elem;      /* Element in reclaim_list. */
+    size_t reclaim_cnt;                 /* Sectors deferred until reclaimed. */
+    struct list_elem flush_elem;        /* Element in a list of inodes to flush. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
+    bool closing;                       /* True while its last opener closes it. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+
+    /* Reader/writer lock on the data of the inode. Reads and
+       writes within the file share it; writes that extend the
+       file hold it exclusively. */
+    struct lock rw_lock;                /* Protects the members below. */
+    struct condition rw_cond;           /* Signaled when the lock frees up. */
+    unsigned readers;                   /* Number of shared holders. */
+    unsigned writers_waiting;           /* Threads waiting to hold it exclusively. */
+    bool writer;                        /* True if held exclusively. */
+
+    /* Copies of inode_disk members, updated along with the
+       on-disk inode, so that reading them takes no disk access. */
+    off_t length;                       /* File size in bytes. */
+    bool isdir;                         /* True if this file is a directory. */
+    bool has_extents;                   /* True if mapped by extents. */
+    bool inlined;                       /* True if data is held inline. */
+    block_sector_t parent;              /* inode_disk sector of the parent directory. */
+    off_t ofs;                          /* Offset of entry in parent directory. */
+    uint32_t num_files;                 /* The number of subdirectories or files. */
+
+    /* Translation of data block indices to sectors, filled from
+       the indirect blocks as needed. */
+    struct lock extent_lock;            /* Protects the members below. */
+    struct extent extents[EXTENT_CNT];  /* Cached extents. */
+    size_t extent_cnt;                  /* Number of cached extents. */
+    size_t extent_hand;                 /* Next extent to replace. */
+
+    /* Data blocks at the end of the file that have no sectors
+       yet, whose data is kept here until they are allocated all
+       at once. Changed only with the reader/writer lock held
+       exclusively. */
+    void *delayed;                      /* Data of the delayed blocks. */
+    size_t delayed_cap;                 /* Number of blocks DELAYED holds. */
+    size_t delayed_start;               /* Index of first delayed block. */
+    size_t delayed_cnt;                 /* Number of delayed blocks. */
+    size_t reserved;                    /* Free sectors reserved for them. */
   };
 
 /* The following functions are meant to be passed as arguments
@@ -63,7 +206,7 @@ typedef bool inode_map_func (size_t start, block_sector_t *sectors,
                              size_t cnt, void *aux);
 
 static bool allocate_sectors (size_t start, block_sector_t *sectors,
-                              size_t cnt, void *aux UNUSED);
+                              size_t cnt, void *aux);
 
 static bool deallocate_sectors (size_t start, block_sector_t *sectors,
                                 size_t cnt, void *aux UNUSED);
@@ -74,32 +217,56 @@ static bool write_to_sectors (size_t start, block_sector_t *sectors,
 static bool read_from_sectors (size_t start, block_sector_t *sectors,
                                size_t cnt, void *aux);
 
+static bool prefetch_sectors (size_t start, block_sector_t *sectors,
+                              size_t cnt, void *aux);
+
+static bool demote_sectors (size_t start, block_sector_t *sectors,
+                            size_t cnt, void *aux UNUSED);
+
+static bool cache_extents (size_t start, block_sector_t *sectors,
+                           size_t cnt, void *aux);
+
+static bool fill_hole_sectors (size_t start, block_sector_t *sectors,
+                               size_t cnt, void *aux);
+
+static bool flush_delayed (struct inode *inode);
+static void drop_delayed (struct inode *inode);
+static size_t allocated_blocks (const struct inode *inode);
+static void inode_lock_exclusive (struct inode *inode);
+static void inode_unlock (struct inode *inode);
+
 /* Applies MAP_FUNC on arrays of sector numbers for all of
    INODE's data blocks indexed between START (inclusive) and
    END (exclusive) in order. The arrays are passed by reference.
-   Assumes that all indirect and doubly indirect pointers in
-   the inode are valid. */
+   DIRTY must be true if MAP_FUNC modifies them. Holes are sector
+   0. Stops as soon as MAP_FUNC fails, which it signals by
+   returning false, and returns false in that case. Every pointer
+   table is released before returning either way. Assumes that
+   all indirect and doubly indirect pointers in the inode are
+   valid. */
 static bool
 inode_map_sectors (const struct inode_disk *inode,
                    inode_map_func *map_func,
                    size_t start, size_t end,
-                   void *aux)
+                   void *aux, bool dirty)
 {
   ASSERT (inode != NULL);
+  ASSERT (!has_extents (inode));
   ASSERT (end <= bytes_to_sectors (MAX_LENGTH));
 
   size_t table_start = 0;
   block_sector_t *sectors;
   block_sector_t *indirects;
+  bool success = true;
 
 /* Applies MAP_FUNC to the portion of SECTORS between the START and
-   END indices, and advances START by the number of sectors mapped. */
+   END indices, stores whether it succeeded in SUCCESS, and
+   advances START by the number of sectors mapped. */
 #define apply(num_pointers) {                                 \
   size_t table_end = num_pointers + table_start;              \
   size_t cnt = (end < table_end ? end : table_end) - start;   \
-  if (!map_func (start, &sectors[start - table_start],        \
-                 cnt, aux))                                   \
-    return false;                                             \
+  success = map_func (start, &sectors[start - table_start],   \
+                      cnt, aux);                              \
   table_start = table_end;                                    \
   start += cnt;                                               \
 }
@@ -109,34 +276,463 @@ inode_map_sectors (const struct inode_disk *inode,
     sectors = (block_sector_t *) inode->direct;
     apply (NUM_DIRECT);
   }
-  if (end <= start)
-    return true;
+  if (!success || end <= start)
+    return success;
 
   /* Apply to indirect blocks. */
   table_start = NUM_DIRECT;
   if (start < NUM_DIRECT + NUM_INDIRECT) {
-    sectors = buffer_cache_get (inode->indirect);
+    sectors = dirty ? buffer_cache_get_exclusive (inode->indirect, BUFFER_META)
+                    : buffer_cache_get_shared (inode->indirect, BUFFER_META);
     apply (NUM_INDIRECT);
-    buffer_cache_release (sectors, true);
+    buffer_cache_release (sectors, dirty);
   }
-  if (end <= start)
-    return true;
+  if (!success || end <= start)
+    return success;
 
   /* Apply to doubly indirect blocks. */
   size_t i = (start - NUM_DIRECT) / NUM_INDIRECT - 1;
   table_start = NUM_DIRECT + (i + 1) * NUM_INDIRECT;
-  indirects = buffer_cache_get (inode->doubly_indirect);
-  while (start < end) {
-    sectors = buffer_cache_get (indirects[i++]);
+  indirects = buffer_cache_get_shared (inode->doubly_indirect, BUFFER_META);
+  while (success && start < end) {
+    sectors = dirty ? buffer_cache_get_exclusive (indirects[i++], BUFFER_META)
+                    : buffer_cache_get_shared (indirects[i++], BUFFER_META);
     apply (NUM_INDIRECT);
-    buffer_cache_release (sectors, true);
+    buffer_cache_release (sectors, dirty);
   }
   buffer_cache_release (indirects, false);
 
 #undef apply
+  return success;
+}
+
+/* Returns the index of the last of the CNT entries in ENTRIES
+   that starts at or before data block INDEX, or 0 if none does.
+   CNT must not be 0. */
+static size_t
+search_extents (const struct disk_extent *entries, size_t cnt, size_t index)
+{
+  size_t lo = 0;
+  size_t hi = cnt;
+  while (hi - lo > 1) {
+    size_t mid = (lo + hi) / 2;
+    if (entries[mid].start <= index)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/* Finds the leaf of INODE's extent tree that maps data block
+   INDEX, and stores its header and entries in *HEADER and
+   *ENTRIES. Stores the first data block past the leaf's part of
+   the tree in *BOUND, or SIZE_MAX if the leaf is the last one.
+   Returns the block holding the leaf, to be released by the
+   caller, or a null pointer if the leaf is the root. */
+static struct extent_block *
+find_extent_leaf (const struct inode_disk *inode, size_t index,
+                  const struct extent_header **header,
+                  const struct disk_extent **entries, size_t *bound)
+{
+  struct extent_block *block = NULL;
+
+  *header = &inode->extent_root;
+  *entries = inode->extents;
+  *bound = SIZE_MAX;
+  while ((*header)->depth > 0) {
+    size_t i = search_extents (*entries, (*header)->cnt, index);
+    block_sector_t child = (*entries)[i].sector;
+    if (i + 1 < (*header)->cnt)
+      *bound = (*entries)[i + 1].start;
+    if (block != NULL)
+      buffer_cache_release (block, false);
+    block = buffer_cache_get_shared (child, BUFFER_META);
+    *header = &block->header;
+    *entries = block->entries;
+  }
+  return block;
+}
+
+/* Stores the extent of INODE, which maps its data blocks with
+   extents, containing data block INDEX in *E. If INDEX is in a
+   hole, *E is the part of the hole starting at INDEX, with
+   sector 0. INDEX must be less than the number of data blocks
+   of INODE. */
+static void
+disk_extent_at (const struct inode_disk *inode, size_t index,
+                struct extent *e)
+{
+  const struct extent_header *header;
+  const struct disk_extent *entries;
+  size_t end;
+  struct extent_block *block = find_extent_leaf (inode, index, &header,
+                                                 &entries, &end);
+  if (end > bytes_to_sectors (inode->length))
+    end = bytes_to_sectors (inode->length);
+
+  e->start = index;
+  e->sector = 0;
+  if (header->cnt > 0) {
+    size_t i = search_extents (entries, header->cnt, index);
+    if (entries[i].start > index)
+      end = entries[i].start;
+    else if (index < entries[i].start + entries[i].cnt) {
+      e->start = entries[i].start;
+      e->sector = entries[i].sector;
+      end = entries[i].start + entries[i].cnt;
+    }
+    else {
+      e->start = entries[i].start + entries[i].cnt;
+      if (i + 1 < header->cnt)
+        end = entries[i + 1].start;
+    }
+  }
+  e->cnt = end - e->start;
+
+  if (block != NULL)
+    buffer_cache_release (block, false);
+}
+
+/* Returns true if extent E continues leaf entry PREV, so that
+   inserting E only lengthens PREV. */
+static bool
+continues_extent (const struct disk_extent *prev, const struct disk_extent *e)
+{
+  return prev->start + prev->cnt == e->start
+         && prev->sector + prev->cnt == e->sector;
+}
+
+/* Returns the number of new nodes that inserting extent E into
+   INODE's extent tree takes: one for each full node on the way
+   to E's leaf that has to split, counted up from the leaf, and
+   one more if the root splits too. */
+static size_t
+extent_nodes_needed (const struct inode_disk *inode,
+                     const struct disk_extent *e)
+{
+  const struct extent_header *header = &inode->extent_root;
+  const struct disk_extent *entries = inode->extents;
+  struct extent_block *block = NULL;
+  size_t capacity = ROOT_EXTENTS;
+  size_t levels = 0, splits = 0;
+
+  for (;;) {
+    size_t i = header->cnt > 0 ? search_extents (entries, header->cnt,
+                                                 e->start)
+                               : 0;
+    bool full = header->cnt == capacity;
+    if (header->depth == 0 && header->cnt > 0
+        && entries[i].start <= e->start
+        && continues_extent (&entries[i], e))
+      full = false;
+    splits = full ? splits + 1 : 0;
+    levels++;
+    if (header->depth == 0)
+      break;
+
+    block_sector_t child = entries[i].sector;
+    if (block != NULL)
+      buffer_cache_release (block, false);
+    block = buffer_cache_get_shared (child, BUFFER_META);
+    header = &block->header;
+    entries = block->entries;
+    capacity = BLOCK_EXTENTS;
+  }
+  if (block != NULL)
+    buffer_cache_release (block, false);
+  return splits == levels ? splits + 1 : splits;
+}
+
+/* Inserts entry E into the node with HEADER and ENTRIES, which
+   has room for CAPACITY entries, at position POS. If the node is
+   full, first moves its upper half into a new node, taken from
+   POOL, or nothing but E if E goes at the end, and stores an
+   index entry for the new node in *SPLIT. Returns true if the
+   node was split. */
+static bool
+insert_entry (struct extent_header *header, struct disk_extent *entries,
+              size_t capacity, size_t pos, const struct disk_extent *e,
+              struct disk_extent *split, struct node_pool *pool)
+{
+  if (header->cnt < capacity) {
+    memmove (&entries[pos + 1], &entries[pos],
+             (header->cnt - pos) * sizeof *entries);
+    entries[pos] = *e;
+    header->cnt++;
+    return false;
+  }
+
+  size_t half = pos == header->cnt ? header->cnt : header->cnt / 2;
+  ASSERT (pool->cnt > 0);
+  block_sector_t sector = pool->sectors[--pool->cnt];
+  struct extent_block *block = buffer_cache_get_for_overwrite (sector,
+                                                              BUFFER_META);
+  memset (block, 0, BLOCK_SECTOR_SIZE);
+  block->header.cnt = header->cnt - half;
+  block->header.depth = header->depth;
+  memcpy (block->entries, &entries[half], block->header.cnt * sizeof *entries);
+  header->cnt = half;
+
+  if (pos >= half)
+    insert_entry (&block->header, block->entries, BLOCK_EXTENTS,
+                  pos - half, e, NULL, pool);
+  else
+    insert_entry (header, entries, capacity, pos, e, NULL, pool);
+
+  split->start = block->entries[0].start;
+  split->sector = sector;
+  split->cnt = 0;
+  buffer_cache_release (block, true);
   return true;
 }
 
+/* Inserts extent E into the subtree rooted at the node with
+   HEADER and ENTRIES, which has room for CAPACITY entries. E is
+   merged into the extent before it if it continues that one.
+   New nodes are taken from POOL. Returns true if the node had
+   to be split, storing an index entry for its new sibling in
+   *SPLIT. */
+static bool
+insert_extent_node (struct extent_header *header, struct disk_extent *entries,
+                    size_t capacity, const struct disk_extent *e,
+                    struct disk_extent *split, struct node_pool *pool)
+{
+  size_t i = header->cnt > 0 ? search_extents (entries, header->cnt, e->start)
+                             : 0;
+
+  if (header->depth == 0) {
+    if (header->cnt > 0 && entries[i].start <= e->start) {
+      if (continues_extent (&entries[i], e)) {
+        entries[i].cnt += e->cnt;
+        return false;
+      }
+      i++;
+    }
+    return insert_entry (header, entries, capacity, i, e, split, pool);
+  }
+
+  /* Index entries start where their subtrees do. */
+  if (e->start < entries[0].start)
+    entries[0].start = e->start;
+
+  struct disk_extent child_split;
+  struct extent_block *child = buffer_cache_get_exclusive (entries[i].sector,
+                                                          BUFFER_META);
+  bool split_child = insert_extent_node (&child->header, child->entries,
+                                         BLOCK_EXTENTS, e, &child_split,
+                                         pool);
+  buffer_cache_release (child, true);
+  return split_child && insert_entry (header, entries, capacity, i + 1,
+                                      &child_split, split, pool);
+}
+
+/* Inserts extent E into INODE's extent tree. If the root has to
+   be split, what is left of it moves into a new node, and the
+   root becomes the parent of that node and its new sibling. The
+   sectors of all new nodes are allocated before the tree is
+   changed. Returns false, leaving the tree unchanged, if there
+   were not enough of them. */
+static bool
+insert_disk_extent (struct inode_disk *inode, const struct disk_extent *e)
+{
+  struct node_pool pool;
+  struct disk_extent split;
+
+  pool.cnt = extent_nodes_needed (inode, e);
+  ASSERT (pool.cnt <= sizeof pool.sectors / sizeof *pool.sectors);
+  if (pool.cnt > 0 && !free_map_allocate_nc (pool.cnt, pool.sectors))
+    return false;
+  if (!insert_extent_node (&inode->extent_root, inode->extents, ROOT_EXTENTS,
+                           e, &split, &pool)) {
+    ASSERT (pool.cnt == 0);
+    return true;
+  }
+
+  ASSERT (pool.cnt == 1);
+  block_sector_t sector = pool.sectors[--pool.cnt];
+  struct extent_block *block = buffer_cache_get_for_overwrite (sector,
+                                                              BUFFER_META);
+  memset (block, 0, BLOCK_SECTOR_SIZE);
+  block->header = inode->extent_root;
+  memcpy (block->entries, inode->extents,
+          inode->extent_root.cnt * sizeof *inode->extents);
+  buffer_cache_release (block, true);
+
+  inode->extent_root.cnt = 2;
+  inode->extent_root.depth++;
+  inode->extents[0].sector = sector;
+  inode->extents[0].cnt = 0;
+  inode->extents[1] = split;
+  return true;
+}
+
+/* Frees the data blocks from index END onward that are mapped by
+   the subtree rooted at the node with HEADER and ENTRIES, along
+   with the nodes of the subtree left empty. */
+static void
+truncate_extents (struct extent_header *header, struct disk_extent *entries,
+                  size_t end)
+{
+  while (header->cnt > 0) {
+    struct disk_extent *last = &entries[header->cnt - 1];
+    if (header->depth == 0) {
+      if (last->start + last->cnt <= end)
+        break;
+      size_t keep = last->start < end ? end - last->start : 0;
+      free_map_release (last->sector + keep, last->cnt - keep);
+      last->cnt = keep;
+      if (keep > 0)
+        break;
+    }
+    else {
+      struct extent_block *child = buffer_cache_get_exclusive (last->sector,
+                                                               BUFFER_META);
+      truncate_extents (&child->header, child->entries, end);
+      bool empty = child->header.cnt == 0;
+      buffer_cache_release (child, true);
+      if (!empty)
+        break;
+      free_map_release (last->sector, 1);
+    }
+    header->cnt--;
+  }
+}
+
+/* Returns an upper bound on the number of sectors it takes to
+   extend an inode mapped by extents by CNT data blocks, counting
+   the new nodes of its extent tree. */
+static size_t
+extent_sectors_needed (size_t cnt)
+{
+  return cnt + DIV_ROUND_UP (cnt, BLOCK_EXTENTS / 2) + 2 * MAX_DEPTH;
+}
+
+/* Drops all of INODE's cached extents. Must be called whenever
+   the data blocks of INODE change. */
+static void
+invalidate_extents (struct inode *inode)
+{
+  lock_acquire (&inode->extent_lock);
+  inode->extent_cnt = 0;
+  inode->extent_hand = 0;
+  lock_release (&inode->extent_lock);
+}
+
+/* Searches INODE's cached extents for data block INDEX. If found,
+   stores the extent in *E and returns true. */
+static bool
+find_extent (struct inode *inode, size_t index, struct extent *e)
+{
+  size_t i;
+  for (i = 0; i < inode->extent_cnt; i++)
+    if (inode->extents[i].start <= index
+        && index < inode->extents[i].start + inode->extents[i].cnt) {
+      *e = inode->extents[i];
+      return true;
+    }
+  return false;
+}
+
+/* Adds E to INODE's cached extents, replacing the oldest one if
+   there is no room. */
+static void
+insert_extent (struct inode *inode, const struct extent *e)
+{
+  if (inode->extent_cnt < EXTENT_CNT)
+    inode->extents[inode->extent_cnt++] = *e;
+  else {
+    inode->extents[inode->extent_hand] = *e;
+    inode->extent_hand = (inode->extent_hand + 1) % EXTENT_CNT;
+  }
+}
+
+/* Caches the extents and holes of INODE, whose contents are
+   DISK_INODE, read from its extent tree, starting with the one
+   containing data block INDEX, up to EXTENT_FILL of them. */
+static void
+cache_disk_extents (struct inode *inode, const struct inode_disk *disk_inode,
+                    size_t index)
+{
+  size_t end = bytes_to_sectors (disk_inode->length);
+  size_t i;
+  for (i = 0; i < EXTENT_FILL && index < end; i++) {
+    struct extent e;
+    disk_extent_at (disk_inode, index, &e);
+    insert_extent (inode, &e);
+    index = e.start + e.cnt;
+  }
+}
+
+/* Auxiliary data for cache_extents (). */
+struct extent_aux {
+  struct inode *inode;          /* Inode whose extents are cached. */
+  size_t left;                  /* Number of extents left to cache. */
+};
+
+/* Stores the extent of INODE containing data block INDEX in *E.
+   On a miss, the on-disk inode is read, and the extents of the
+   rest of INDEX's pointer table are cached as well, up to
+   EXTENT_FILL of them. INDEX must be less than the number of
+   data blocks of INODE. */
+static void
+lookup_extent (struct inode *inode, size_t index, struct extent *e)
+{
+  lock_acquire (&inode->extent_lock);
+  if (!find_extent (inode, index, e)) {
+    struct inode_disk *disk_inode = buffer_cache_get_shared (inode->sector,
+                                                             BUFFER_META);
+    size_t end = NUM_DIRECT;
+    if (index >= NUM_DIRECT)
+      end += ROUND_UP (index - NUM_DIRECT + 1, NUM_INDIRECT);
+    if (end > bytes_to_sectors (disk_inode->length))
+      end = bytes_to_sectors (disk_inode->length);
+
+    if (has_extents (disk_inode))
+      cache_disk_extents (inode, disk_inode, index);
+    else {
+      struct extent_aux aux = {inode, EXTENT_FILL};
+      inode_map_sectors (disk_inode, cache_extents, index, end, &aux, false);
+    }
+    buffer_cache_release (disk_inode, false);
+    if (!find_extent (inode, index, e))
+      NOT_REACHED ();
+  }
+  lock_release (&inode->extent_lock);
+}
+
+/* Maximum number of sectors passed to a map function at once by
+   inode_map_extents (). */
+#define EXTENT_BATCH 32
+
+/* Like inode_map_sectors (), but translates the data block
+   indices with INODE's cached extents, so that indirect blocks
+   are only read on a miss. MAP_FUNC must not modify the arrays
+   it is passed, in which holes are sector 0. */
+static void
+inode_map_extents (struct inode *inode, inode_map_func *map_func,
+                   size_t start, size_t end, void *aux)
+{
+  block_sector_t sectors[EXTENT_BATCH];
+  while (start < end) {
+    struct extent e;
+    lookup_extent (inode, start, &e);
+
+    size_t cnt = e.start + e.cnt - start;
+    if (cnt > end - start)
+      cnt = end - start;
+    if (cnt > EXTENT_BATCH)
+      cnt = EXTENT_BATCH;
+
+    size_t i;
+    for (i = 0; i < cnt; i++)
+      sectors[i] = e.sector != 0 ? e.sector + (start - e.start) + i : 0;
+    if (!map_func (start, sectors, cnt, aux))
+      return;
+    start += cnt;
+  }
+}
+
 /* Shortens the length of INODE to LENGTH, deallocating sectors
    as necessary. */
 static void
@@ -145,12 +741,27 @@ shorten_inode_length (struct inode_disk *inode, off_t length)
   ASSERT (inode != NULL);
   ASSERT (length <= inode->length);
 
+  if (inode->inlined) {
+    memset (inode->data + length, 0, inode->length - length);
+    inode->length = length;
+    return;
+  }
+
+  if (has_extents (inode)) {
+    truncate_extents (&inode->extent_root, inode->extents,
+                      bytes_to_sectors (length));
+    if (inode->extent_root.cnt == 0)
+      inode->extent_root.depth = 0;
+    inode->length = length;
+    return;
+  }
+
   size_t start = bytes_to_sectors (length);
   size_t end = bytes_to_sectors (inode->length);
   size_t border = NUM_DIRECT;
 
   /* Free leaf nodes. */
-  inode_map_sectors (inode, deallocate_sectors, start, end, NULL);
+  inode_map_sectors (inode, deallocate_sectors, start, end, NULL, true);
 
   /* Free INDIRECT. */
   if (start <= border && border < end)
@@ -162,7 +773,8 @@ shorten_inode_length (struct inode_disk *inode, off_t length)
   if (border < end) {
     size_t i = (start > border) ? DIV_ROUND_UP (start - border, NUM_INDIRECT) : 0;
     size_t cnt = DIV_ROUND_UP (end - border,  NUM_INDIRECT) - i;
-    block_sector_t *indirects = buffer_cache_get (inode->doubly_indirect);
+    block_sector_t *indirects
+      = buffer_cache_get_exclusive (inode->doubly_indirect, BUFFER_META);
     free_map_release_nc (&indirects[i], cnt);
     buffer_cache_release (indirects, true);
   }
@@ -174,27 +786,205 @@ shorten_inode_length (struct inode_disk *inode, off_t length)
   inode->length = length;
 }
 
+/* Returns an upper bound on the number of sectors it takes to
+   extend an inode with START data blocks to END data blocks,
+   leaving the new ones before FIRST as holes. The inode maps its
+   data blocks with extents if EXTENTS is true. */
+static size_t
+sectors_needed (bool extents, size_t start, size_t first, size_t end)
+{
+  if (extents)
+    return extent_sectors_needed (end - first);
+  return end - first + (end / NUM_DIRECT) - (start / NUM_DIRECT);
+}
+
+/* Auxiliary data for allocate_sectors (). */
+struct alloc_aux {
+  enum buffer_class class;      /* Class of the new sectors. */
+  size_t keep_start;            /* First new sector not to zero out. */
+  size_t keep_end;              /* End of the new sectors not to zero out. */
+  block_sector_t goal;          /* Preferred sector for the first new
+                                   sector, if mapped by extents. */
+  size_t reserved;              /* Sectors reserved for the new sectors. */
+  size_t alloc_start;           /* New data blocks before this one are
+                                   left as holes. */
+  bool contiguous;              /* Look for the longest runs of free
+                                   sectors when filling holes. */
+};
+
+/* Returns the sector after the one holding data block INDEX - 1
+   of INODE, which maps its data blocks with extents, so that
+   data block INDEX may continue its extent. Returns GOAL if
+   INDEX is 0 or data block INDEX - 1 is a hole. */
+static block_sector_t
+extent_goal (const struct inode_disk *inode, size_t index,
+             block_sector_t goal)
+{
+  if (index > 0) {
+    struct extent e;
+    disk_extent_at (inode, index - 1, &e);
+    if (e.sector != 0)
+      goal = e.sector + (index - e.start);
+  }
+  return goal;
+}
+
+/* Allocates sectors for data blocks START through END - 1 of
+   INODE, which maps its data blocks with extents and has holes
+   there, preferring sectors that continue data block START - 1.
+   The new sectors are zeroed out as described by AUX. Must be
+   called with free_map_lock held, after making sure there is
+   enough space. Returns false if the extent tree could not get
+   the nodes it needed, leaving the data blocks not yet mapped as
+   holes. */
+static bool
+allocate_extents (struct inode_disk *inode, size_t start, size_t end,
+                  const struct alloc_aux *aux)
+{
+  block_sector_t goal = extent_goal (inode, start, aux->goal);
+  void *zeros = calloc (BLOCK_SECTOR_SIZE, 1);
+  while (start < end) {
+    struct disk_extent e;
+    e.start = start;
+    e.cnt = aux->contiguous
+            ? free_map_allocate_run (end - start, goal, &e.sector)
+            : free_map_allocate_extent (end - start, goal, &e.sector);
+    ASSERT (e.cnt > 0);
+
+    size_t i;
+    for (i = 0; i < e.cnt; i++)
+      if (start + i < aux->keep_start || start + i >= aux->keep_end)
+        buffer_cache_write (e.sector + i, zeros, aux->class);
+    if (!insert_disk_extent (inode, &e)) {
+      free_map_release (e.sector, e.cnt);
+      free (zeros);
+      return false;
+    }
+
+    start += e.cnt;
+    goal = e.sector + e.cnt;
+  }
+  free (zeros);
+  return true;
+}
+
+/* Extends the length of INODE, which maps its data blocks with
+   extents, to LENGTH, as extend_inode_length () does. Each new
+   run of sectors is allocated right after the previous one if
+   possible. */
+static bool
+extend_extents (struct inode_disk *inode, off_t length,
+                struct alloc_aux *aux)
+{
+  size_t start = bytes_to_sectors (inode->length);
+  size_t end = bytes_to_sectors (length);
+  size_t first = aux->alloc_start > start ? aux->alloc_start : start;
+  if (first > end)
+    first = end;
+
+  /* Acquire free map lock and check available space. */
+  size_t needed = sectors_needed (true, start, first, end);
+  lock_acquire (&free_map_lock);
+  if (needed > aux->reserved
+      && !free_map_wait_for_space (needed - aux->reserved)) {
+    lock_release (&free_map_lock);
+    return false;
+  }
+  free_map_unreserve (aux->reserved);
+
+  /* Holes take no extents. Should the extent tree run out of
+     space anyway, the extension is taken back. */
+  off_t old_length = inode->length;
+  inode->length = length;
+  bool success = allocate_extents (inode, first, end, aux);
+  if (!success)
+    shorten_inode_length (inode, old_length);
+
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Moves the data INODE holds inline into a newly allocated first
+   data block, so that INODE maps its data blocks as its magic
+   says from then on. The new sector is of the class AUX says and
+   preferably AUX's goal. Returns false if memory or disk space
+   runs out, leaving INODE unchanged. */
+static bool
+move_inline_data (struct inode_disk *inode, const struct alloc_aux *aux)
+{
+  block_sector_t sector = 0;
+  if (inode->length > 0) {
+    uint8_t *block = calloc (BLOCK_SECTOR_SIZE, 1);
+    if (block == NULL)
+      return false;
+    if (free_map_allocate_extent (1, aux->goal, &sector) == 0) {
+      free (block);
+      return false;
+    }
+    memcpy (block, inode->data, inode->length);
+    buffer_cache_write (sector, block, aux->class);
+    free (block);
+  }
+
+  memset (inode->data, 0, sizeof inode->data);
+  inode->inlined = false;
+  if (sector != 0) {
+    if (has_extents (inode)) {
+      /* An empty extent tree takes its first extent in the root. */
+      struct disk_extent e = {0, sector, 1};
+      if (!insert_disk_extent (inode, &e))
+        NOT_REACHED ();
+    }
+    else
+      inode->direct[0] = sector;
+  }
+  return true;
+}
+
 /* Extends the length of INODE to the LENGTH, allocating new
-   sectors as needed. */
+   sectors as needed. New data blocks before the one AUX says to
+   start allocating at are left as holes, which take no sectors
+   and read as zeros. The new sectors are zeroed out as described
+   by AUX, and the sectors AUX says are reserved for them are
+   released once they are allocated. Data held inline moves into
+   a data block once it no longer fits. */
 static bool
-extend_inode_length (struct inode_disk *inode, off_t length)
+extend_inode_length (struct inode_disk *inode, off_t length,
+                     struct alloc_aux *aux)
 {
   ASSERT (inode != NULL);
   ASSERT (length <= MAX_LENGTH);
   ASSERT (length >= inode->length);
 
+  /* Data held inline is already zero-padded. */
+  if (inode->inlined) {
+    if (length <= (off_t) INLINE_SIZE) {
+      inode->length = length;
+      return true;
+    }
+    if (!move_inline_data (inode, aux))
+      return false;
+  }
+
+  if (has_extents (inode))
+    return extend_extents (inode, length, aux);
+
   size_t start = bytes_to_sectors (inode->length);
   size_t end = bytes_to_sectors (length);
+  size_t first = aux->alloc_start > start ? aux->alloc_start : start;
   size_t border = NUM_DIRECT;
+  if (first > end)
+    first = end;
 
   /* Acquire free map lock and check available space. */
+  size_t needed = sectors_needed (false, start, first, end);
   lock_acquire (&free_map_lock);
-  if (free_map_available_space () < end - start
-                                    + (end / NUM_DIRECT)
-                                    - (start / NUM_DIRECT)) {
+  if (needed > aux->reserved
+      && !free_map_wait_for_space (needed - aux->reserved)) {
     lock_release (&free_map_lock);
     return false;
   }
+  free_map_unreserve (aux->reserved);
 
   /* Allocate INDIRECT. */
   if (start <= border && border < end)
@@ -210,28 +1000,86 @@ extend_inode_length (struct inode_disk *inode, off_t length)
   if (border < end) {
     size_t i = (start > border) ? DIV_ROUND_UP (start - border , NUM_INDIRECT) : 0;
     size_t cnt = DIV_ROUND_UP (end - border, NUM_INDIRECT) - i;
-    block_sector_t *indirects = buffer_cache_get (inode->doubly_indirect);
+    block_sector_t *indirects
+      = buffer_cache_get_exclusive (inode->doubly_indirect, BUFFER_META);
     free_map_allocate_nc (cnt, &indirects[i]);
     buffer_cache_release (indirects, true);
   }
 
   /* Allocate all leaf nodes and set INODE's LENGTH. */
-  inode_map_sectors (inode, allocate_sectors, start, end, NULL);
+  inode_map_sectors (inode, allocate_sectors, start, end, aux, true);
   lock_release (&free_map_lock);
   inode->length = length;
   return true;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Returns the buffer cache class of the data blocks of the
+   inode in SECTOR, which is a directory if ISDIR is true.
+   Directories and the free map are file system metadata. */
+static enum buffer_class
+data_class (block_sector_t sector, bool isdir)
+{
+  return isdir || sector == FREE_MAP_SECTOR ? BUFFER_META : BUFFER_DATA;
+}
+
+/* Hash table of open inodes, keyed by sector, so that opening a
+   single inode twice returns the same `struct inode'. */
+static struct hash open_inodes;
+static struct lock open_inodes_lock;
+
+static hash_hash_func inode_hash;
+static hash_less_func inode_less;
+
+/* Removed inodes closed by their last opener, whose sectors are
+   freed in the background by the reclaimer thread, oldest
+   first. */
+static struct list reclaim_list;
+static struct lock reclaim_lock;        /* Protects reclaim_list. */
+static struct lock reclaiming_lock;     /* Held while freeing an inode's sectors. */
+static struct semaphore reclaim_sema;   /* Upped once per queued inode. */
+
+static thread_func reclaim_thread_func;
+
+/* Serializes flush_open_inodes (), which lists inodes by their
+   flush_elem. */
+static struct lock flush_lock;
 
 /* Initializes the inode module. */
 void
 inode_init (void)
 {
-  list_init (&open_inodes);
-  thread_current()->cwd = inode_open(ROOT_DIR_SECTOR);
+  hash_init (&open_inodes, inode_hash, inode_less, NULL);
+  lock_init (&open_inodes_lock);
+
+  list_init (&reclaim_list);
+  lock_init (&reclaim_lock);
+  lock_init (&reclaiming_lock);
+  sema_init (&reclaim_sema, 0);
+  lock_init (&flush_lock);
+  thread_create ("reclaimer", PRI_DEFAULT, reclaim_thread_func, NULL);
+}
+
+/* Returns the open inode in SECTOR, or a null pointer if there
+   is none. Must be called with open_inodes_lock held. */
+static struct inode *
+find_open_inode (block_sector_t sector)
+{
+  struct inode key;
+  struct hash_elem *e;
+
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.elem);
+  return e != NULL ? hash_entry (e, struct inode, elem) : NULL;
+}
+
+/* Like inode_reopen (), but must be called with open_inodes_lock
+   held. */
+static struct inode *
+reopen_locked (struct inode *inode)
+{
+  if (inode != NULL)
+    inode->open_cnt++;
+  return inode;
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -251,13 +1099,26 @@ inode_create (block_sector_t sector, off_t length, bool isdir)
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
 
-  disk_inode = buffer_cache_get (sector);
+  disk_inode = buffer_cache_get_exclusive (sector, BUFFER_META);
   disk_inode->parent = sector;
   disk_inode->length = 0;
   disk_inode->isdir = isdir;
   disk_inode->num_files = 0;
-  disk_inode->magic = INODE_MAGIC;
-  success = extend_inode_length (disk_inode, length);
+  disk_inode->inlined = length <= (off_t) INLINE_SIZE;
+  if (disk_inode->inlined)
+    memset (disk_inode->data, 0, sizeof disk_inode->data);
+  if (inode_use_extents) {
+    disk_inode->magic = EXTENT_MAGIC;
+    disk_inode->extent_root.cnt = 0;
+    disk_inode->extent_root.depth = 0;
+  }
+  else
+    disk_inode->magic = INODE_MAGIC;
+  enum buffer_class class = data_class (sector, isdir);
+  struct alloc_aux aux = {class, 0, 0, sector + 1, 0,
+                          class == BUFFER_DATA ? bytes_to_sectors (length) : 0,
+                          false};
+  success = extend_inode_length (disk_inode, length, &aux);
   buffer_cache_release (disk_inode, true);
   return success;
 }
@@ -268,20 +1129,15 @@ inode_create (block_sector_t sector, off_t length, bool isdir)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
   struct inode *inode;
+  struct inode *open;
 
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e))
-    {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector)
-        {
-          inode_reopen (inode);
-          return inode;
-        }
-    }
+  lock_acquire (&open_inodes_lock);
+  inode = reopen_locked (find_open_inode (sector));
+  lock_release (&open_inodes_lock);
+  if (inode != NULL)
+    return inode;
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
@@ -289,11 +1145,46 @@ inode_open (block_sector_t sector)
     return NULL;
 
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
   inode->sector = sector;
   inode->open_cnt = 1;
+  inode->closing = false;
   inode->deny_write_cnt = 0;
   inode->removed = false;
+  lock_init (&inode->rw_lock);
+  cond_init (&inode->rw_cond);
+  inode->readers = 0;
+  inode->writers_waiting = 0;
+  inode->writer = false;
+  lock_init (&inode->extent_lock);
+  inode->extent_cnt = 0;
+  inode->extent_hand = 0;
+  inode->delayed = NULL;
+  inode->delayed_cap = 0;
+  inode->delayed_start = 0;
+  inode->delayed_cnt = 0;
+  inode->reserved = 0;
+
+  struct inode_disk *disk_inode = buffer_cache_get_shared (sector,
+                                                           BUFFER_META);
+  inode->length = disk_inode->length;
+  inode->isdir = disk_inode->isdir;
+  inode->has_extents = has_extents (disk_inode);
+  inode->inlined = disk_inode->inlined;
+  inode->parent = disk_inode->parent;
+  inode->ofs = disk_inode->ofs;
+  inode->num_files = disk_inode->num_files;
+  buffer_cache_release (disk_inode, false);
+
+  /* Someone else may have opened the inode in the meantime. */
+  lock_acquire (&open_inodes_lock);
+  open = reopen_locked (find_open_inode (sector));
+  if (open == NULL)
+    hash_insert (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
+  if (open != NULL) {
+    free (inode);
+    inode = open;
+  }
   return inode;
 }
 
@@ -301,8 +1192,9 @@ inode_open (block_sector_t sector)
 struct inode *
 inode_reopen (struct inode *inode)
 {
-  if (inode != NULL)
-    inode->open_cnt++;
+  lock_acquire (&open_inodes_lock);
+  reopen_locked (inode);
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
@@ -313,9 +1205,74 @@ inode_get_inumber (const struct inode *inode)
   return inode->sector;
 }
 
+/* Returns the number of sectors of removed INODE counted as
+   available until they are freed: its own and those of its data
+   blocks that have sectors. Its index blocks are not counted, nor
+   are holes and delayed data blocks, which have no sectors. */
+static size_t
+reclaim_size (struct inode *inode)
+{
+  size_t cnt = 1;
+  size_t start = 0;
+  size_t end = inode->inlined ? 0 : allocated_blocks (inode);
+  while (start < end) {
+    struct extent e;
+    lookup_extent (inode, start, &e);
+    size_t stop = e.start + e.cnt < end ? e.start + e.cnt : end;
+    if (e.sector != 0)
+      cnt += stop - start;
+    start = stop;
+  }
+  return cnt;
+}
+
+/* Frees the sectors of the oldest inode queued for reclamation,
+   and the inode itself. Returns false if the queue is empty.
+   Must be called with reclaiming_lock held. */
+static bool
+reclaim_next (void)
+{
+  struct inode *inode = NULL;
+
+  lock_acquire (&reclaim_lock);
+  if (!list_empty (&reclaim_list))
+    inode = list_entry (list_pop_front (&reclaim_list), struct inode,
+                        reclaim_elem);
+  lock_release (&reclaim_lock);
+  if (inode == NULL)
+    return false;
+
+  struct inode_disk *data = buffer_cache_get_exclusive (inode->sector,
+                                                        BUFFER_META);
+  shorten_inode_length (data, 0);
+  buffer_cache_release (data, true);
+  free_map_release (inode->sector, 1);
+  free_map_undefer (inode->reclaim_cnt);
+  free (inode);
+  return true;
+}
+
+/* Reclaimer thread. Frees the sectors of removed inodes once
+   their last opener has closed them, so that closing them need
+   not update the free map. Allocations that need the sectors wait for it
+   meanwhile, so it runs at the priority of the threads that make
+   them; at a lower priority, the scheduler would never run it
+   while they are runnable. */
+static void
+reclaim_thread_func (void *aux UNUSED)
+{
+  while (true) {
+    sema_down (&reclaim_sema);
+    lock_acquire (&reclaiming_lock);
+    reclaim_next ();
+    lock_release (&reclaiming_lock);
+  }
+}
+
 /* Closes INODE and writes it to disk.
    If this was the last reference to INODE, frees its memory.
-   If INODE was also a removed inode, frees its blocks. */
+   If INODE was also a removed inode, queues it for the reclaimer
+   thread to free its blocks and memory. */
 void
 inode_close (struct inode *inode)
 {
@@ -323,23 +1280,54 @@ inode_close (struct inode *inode)
   if (inode == NULL)
     return;
 
-  /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  /* Nothing to do unless this was the last opener. If INODE is
+     already being closed, the thread doing that finishes the
+     job. */
+  lock_acquire (&open_inodes_lock);
+  if (--inode->open_cnt > 0 || inode->closing)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
+      lock_release (&open_inodes_lock);
+      return;
+    }
+  inode->closing = true;
 
-      /* Deallocate blocks if removed. */
-      if (inode->removed)
+  /* Allocate the delayed blocks while INODE is still in the hash,
+     so that a new opener does not read the inode from disk before
+     they are. If someone opens INODE meanwhile, leave it to them
+     to close it. */
+  while (!inode->removed && inode->delayed_cnt > 0)
+    {
+      lock_release (&open_inodes_lock);
+      inode_lock_exclusive (inode);
+      if (!flush_delayed (inode))
+        drop_delayed (inode);
+      inode_unlock (inode);
+      lock_acquire (&open_inodes_lock);
+      if (inode->open_cnt > 0)
         {
-          struct inode_disk *data = buffer_cache_get (inode->sector);
-          shorten_inode_length (data, 0);
-          buffer_cache_release (data, true);
-          free_map_release (inode->sector, 1);
+          inode->closing = false;
+          lock_release (&open_inodes_lock);
+          return;
         }
+    }
+  hash_delete (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
 
-      free (inode);
+  /* Queue blocks to be deallocated if removed. */
+  if (inode->removed)
+    {
+      free_map_unreserve (inode->reserved);
+      free (inode->delayed);
+      inode->reclaim_cnt = reclaim_size (inode);
+      free_map_defer (inode->reclaim_cnt);
+      lock_acquire (&reclaim_lock);
+      list_push_back (&reclaim_list, &inode->reclaim_elem);
+      lock_release (&reclaim_lock);
+      sema_up (&reclaim_sema);
+      return;
     }
+  free (inode->delayed);
+  free (inode);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -357,20 +1345,250 @@ struct buffer_aux {
   off_t size;
   off_t pos;
   off_t offset;
+  enum buffer_class class;
+  enum inode_caching caching;
 };
 
-/* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
-   Returns the number of bytes actually read, which may be less
-   than SIZE if an end of file is reached. */
+/* Acquires INODE's reader/writer lock for shared use, waiting
+   for exclusive holders and waiters first. */
+static void
+inode_lock_shared (struct inode *inode)
+{
+  lock_acquire (&inode->rw_lock);
+  while (inode->writer || inode->writers_waiting > 0)
+    cond_wait (&inode->rw_cond, &inode->rw_lock);
+  inode->readers++;
+  lock_release (&inode->rw_lock);
+}
+
+/* Acquires INODE's reader/writer lock for exclusive use. */
+static void
+inode_lock_exclusive (struct inode *inode)
+{
+  lock_acquire (&inode->rw_lock);
+  inode->writers_waiting++;
+  while (inode->writer || inode->readers > 0)
+    cond_wait (&inode->rw_cond, &inode->rw_lock);
+  inode->writers_waiting--;
+  inode->writer = true;
+  lock_release (&inode->rw_lock);
+}
+
+/* Releases INODE's reader/writer lock. */
+static void
+inode_unlock (struct inode *inode)
+{
+  lock_acquire (&inode->rw_lock);
+  if (inode->writer)
+    inode->writer = false;
+  else
+    inode->readers--;
+  if (inode->readers == 0)
+    cond_broadcast (&inode->rw_cond, &inode->rw_lock);
+  lock_release (&inode->rw_lock);
+}
+
+/* Returns the number of data blocks of INODE that have sectors,
+   which is the index of its first delayed data block if it has
+   any. */
+static size_t
+allocated_blocks (const struct inode *inode)
+{
+  return inode->delayed_cnt > 0 ? inode->delayed_start
+                                : bytes_to_sectors (inode->length);
+}
+
+/* Extends INODE to LENGTH without allocating sectors for its new
+   data blocks, reserving free sectors for them instead. The
+   buffer holding their data grows as needed, doubling each time.
+   INODE's reader/writer lock must be held exclusively. Returns
+   false if the delayed data blocks would not fit in DELAY_CNT,
+   or if memory or disk space runs out. */
+static bool
+delay_blocks (struct inode *inode, off_t length)
+{
+  size_t start = allocated_blocks (inode);
+  size_t end = bytes_to_sectors (length);
+
+  if (end - start > DELAY_CNT || (inode->delayed_cnt == 0 && end == start))
+    return false;
+  if (end - start > inode->delayed_cap) {
+    size_t cap = inode->delayed_cap > 0 ? inode->delayed_cap : 1;
+    while (cap < end - start)
+      cap *= 2;
+    if (cap > DELAY_CNT)
+      cap = DELAY_CNT;
+    void *delayed = realloc (inode->delayed, cap * BLOCK_SECTOR_SIZE);
+    if (delayed == NULL)
+      return false;
+    inode->delayed = delayed;
+    inode->delayed_cap = cap;
+  }
+  size_t reserve = sectors_needed (inode->has_extents, start, start, end);
+  if (!free_map_reserve (reserve - inode->reserved))
+    return false;
+
+  /* On disk, the file ends with its last sector, whose unused
+     bytes were zeroed when it was allocated. */
+  if (inode->delayed_cnt == 0) {
+    struct inode_disk *disk_inode = buffer_cache_get_exclusive (inode->sector,
+                                                                BUFFER_META);
+    disk_inode->length = start * BLOCK_SECTOR_SIZE;
+    buffer_cache_release (disk_inode, true);
+    inode->delayed_start = start;
+  }
+
+  memset (inode->delayed + inode->delayed_cnt * BLOCK_SECTOR_SIZE, 0,
+          (end - start - inode->delayed_cnt) * BLOCK_SECTOR_SIZE);
+  inode->delayed_cnt = end - start;
+  inode->reserved = reserve;
+  inode->length = length;
+  return true;
+}
+
+/* Allocates sectors for all of INODE's delayed data blocks at
+   once, without zeroing them out, and writes their data to the
+   buffer cache. INODE's reader/writer lock must be held
+   exclusively. Returns false if the sectors could not be
+   allocated, in which case the blocks stay delayed. */
+static bool
+flush_delayed (struct inode *inode)
+{
+  if (inode->delayed_cnt == 0)
+    return true;
+
+  size_t start = inode->delayed_start;
+  size_t end = start + inode->delayed_cnt;
+  struct alloc_aux alloc = {data_class (inode->sector, inode->isdir),
+                            start, end, inode->sector + 1, inode->reserved,
+                            0, false};
+  struct inode_disk *disk_inode = buffer_cache_get_exclusive (inode->sector,
+                                                              BUFFER_META);
+  if (!extend_inode_length (disk_inode, inode->length, &alloc)) {
+    buffer_cache_release (disk_inode, false);
+    return false;
+  }
+  buffer_cache_release (disk_inode, true);
+  inode->delayed_cnt = 0;
+  inode->reserved = 0;
+  invalidate_extents (inode);
+
+  struct buffer_aux aux = {inode->delayed, (end - start) * BLOCK_SECTOR_SIZE,
+                           0, start * BLOCK_SECTOR_SIZE, alloc.class,
+                           INODE_CACHED};
+  inode_map_extents (inode, write_to_sectors, start, end, &aux);
+  return true;
+}
+
+/* Discards INODE's delayed data blocks, shortening INODE to the
+   data blocks that have sectors, for when they cannot be
+   allocated and no one is left to report that to. INODE's
+   reader/writer lock must be held exclusively. */
+static void
+drop_delayed (struct inode *inode)
+{
+  if (inode->delayed_cnt == 0)
+    return;
+  free_map_unreserve (inode->reserved);
+  inode->length = inode->delayed_start * BLOCK_SECTOR_SIZE;
+  inode->delayed_cnt = 0;
+  inode->reserved = 0;
+}
+
+/* Copies the rest of the transfer described by AUX, which lies
+   within INODE's delayed data blocks, into INODE's delayed data
+   if WRITE is true, and out of it otherwise. */
+static void
+copy_delayed (struct inode *inode, struct buffer_aux *aux, bool write)
+{
+  off_t ofs = aux->offset - inode->delayed_start * BLOCK_SECTOR_SIZE;
+  off_t cnt = aux->size - aux->pos;
+  ASSERT (ofs >= 0
+          && ofs + cnt <= (off_t) inode->delayed_cnt * BLOCK_SECTOR_SIZE);
+
+  if (write)
+    memcpy (inode->delayed + ofs, aux->buffer + aux->pos, cnt);
+  else
+    memcpy (aux->buffer + aux->pos, inode->delayed + ofs, cnt);
+  aux->offset += cnt;
+  aux->pos += cnt;
+}
+
+/* Returns true if any of data blocks START through END - 1 of
+   INODE, which must have sectors, is a hole. */
+static bool
+has_holes (struct inode *inode, size_t start, size_t end)
+{
+  while (start < end) {
+    struct extent e;
+    lookup_extent (inode, start, &e);
+    if (e.sector == 0)
+      return true;
+    start = e.start + e.cnt;
+  }
+  return false;
+}
+
+/* Allocates sectors for the holes among data blocks START through
+   END - 1 of INODE, which must have sectors, zeroing them out as
+   described by AUX. INODE's reader/writer lock must be held
+   exclusively. Returns false if memory or disk space runs out,
+   in which case some of the holes may have been filled. */
+static bool
+fill_holes (struct inode *inode, size_t start, size_t end,
+            struct alloc_aux *aux)
+{
+  if (!has_holes (inode, start, end))
+    return true;
+
+  bool success;
+  struct inode_disk *disk_inode = buffer_cache_get_exclusive (inode->sector,
+                                                              BUFFER_META);
+  if (has_extents (disk_inode)) {
+    lock_acquire (&free_map_lock);
+    success = free_map_wait_for_space (extent_sectors_needed (end - start));
+    while (success && start < end) {
+      struct extent e;
+      disk_extent_at (disk_inode, start, &e);
+      size_t stop = e.start + e.cnt < end ? e.start + e.cnt : end;
+      if (e.sector == 0)
+        success = allocate_extents (disk_inode, start, stop, aux);
+      start = stop;
+    }
+    lock_release (&free_map_lock);
+  }
+  else
+    success = inode_map_sectors (disk_inode, fill_hole_sectors, start, end,
+                                 aux, true);
+  buffer_cache_release (disk_inode, true);
+  invalidate_extents (inode);
+  return success;
+}
+
+/* Like inode_read_at (), but caches the data read as CACHING
+   says. */
 off_t
-inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
+inode_read_at_caching (struct inode *inode, void *buffer_, off_t size,
+                       off_t offset, enum inode_caching caching)
 {
-  struct inode_disk *disk_inode = buffer_cache_get (inode->sector);
-  if (disk_inode->length < offset)
+  inode_lock_shared (inode);
+  if (inode->length < offset) {
+    inode_unlock (inode);
     return 0;
+  }
   /* Read up until the end-of-file. */
-  if (disk_inode->length < offset + size)
-    size = disk_inode->length - offset;
+  if (inode->length < offset + size)
+    size = inode->length - offset;
+
+  /* Small files take no sector but the inode's own. */
+  if (inode->inlined) {
+    struct inode_disk *disk_inode = buffer_cache_get_shared (inode->sector,
+                                                             BUFFER_META);
+    memcpy (buffer_, disk_inode->data + offset, size);
+    buffer_cache_release (disk_inode, false);
+    inode_unlock (inode);
+    return size;
+  }
 
   size_t start = offset / BLOCK_SECTOR_SIZE;
   size_t end = DIV_ROUND_UP (offset + size, BLOCK_SECTOR_SIZE);
@@ -379,45 +1597,329 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
   aux->size = size;
   aux->offset = offset;
   aux->pos = 0;
-
-  inode_map_sectors (disk_inode, read_from_sectors, start, end, aux);
-  buffer_cache_release (disk_inode, false);
+  aux->class = data_class (inode->sector, inode->isdir);
+  aux->caching = caching;
+
+  size_t split = allocated_blocks (inode);
+  if (start < split)
+    inode_map_extents (inode, read_from_sectors, start,
+                       end < split ? end : split, aux);
+  if (end > split)
+    copy_delayed (inode, aux, false);
+  inode_unlock (inode);
   free (aux);
 
   return size;
 }
 
-/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
-   Returns the number of bytes actually written, which may be
-   less than SIZE if an error occurs. */
+/* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
+   Returns the number of bytes actually read, which may be less
+   than SIZE if an end of file is reached. */
 off_t
-inode_write_at (struct inode *inode, const void *buffer_, off_t size,
-                off_t offset)
+inode_read_at (struct inode *inode, void *buffer, off_t size, off_t offset)
+{
+  return inode_read_at_caching (inode, buffer, size, offset, INODE_CACHED);
+}
+
+/* Asks the buffer cache to read the sectors holding the SIZE
+   bytes of INODE starting at OFFSET in the background. Data past
+   the end of INODE is ignored. */
+void
+inode_read_ahead (struct inode *inode, off_t offset, off_t size)
+{
+  inode_lock_shared (inode);
+  if (inode->length < offset + size)
+    size = inode->length - offset;
+
+  if (size > 0 && !inode->inlined) {
+    size_t start = offset / BLOCK_SECTOR_SIZE;
+    size_t end = DIV_ROUND_UP (offset + size, BLOCK_SECTOR_SIZE);
+    enum buffer_class class = data_class (inode->sector, inode->isdir);
+    if (end > allocated_blocks (inode))
+      end = allocated_blocks (inode);
+    if (start < end)
+      inode_map_extents (inode, prefetch_sectors, start, end, &class);
+  }
+  inode_unlock (inode);
+}
+
+/* Moves the cached sectors holding the SIZE bytes of INODE
+   starting at OFFSET to the cold end of the buffer cache's
+   replacement order. Data past the end of INODE is ignored. */
+void
+inode_demote (struct inode *inode, off_t offset, off_t size)
+{
+  inode_lock_shared (inode);
+  if (inode->length < offset + size)
+    size = inode->length - offset;
+
+  if (size > 0 && !inode->inlined) {
+    size_t start = offset / BLOCK_SECTOR_SIZE;
+    size_t end = DIV_ROUND_UP (offset + size, BLOCK_SECTOR_SIZE);
+    if (end > allocated_blocks (inode))
+      end = allocated_blocks (inode);
+    if (start < end)
+      inode_map_extents (inode, demote_sectors, start, end, NULL);
+  }
+  inode_unlock (inode);
+}
+
+/* Like inode_write_at (), but caches the data written as
+   CACHING says. */
+off_t
+inode_write_at_caching (struct inode *inode, const void *buffer_, off_t size,
+                        off_t offset, enum inode_caching caching)
 {
   if (inode->deny_write_cnt)
     return 0;
 
-  struct inode_disk *disk_inode = buffer_cache_get (inode->sector);
-  if (disk_inode->length < offset + size)
+  size_t start = offset / BLOCK_SECTOR_SIZE;
+  size_t end = DIV_ROUND_UP (offset + size, BLOCK_SECTOR_SIZE);
+  enum buffer_class class = data_class (inode->sector, inode->isdir);
+
+  /* Extending INODE needs the lock exclusively. The length is read
+     without the lock first, and checked again under it, since
+     inode_allocate () shrinks a file back when it fails to fill
+     in an extension. Writes into holes allocate sectors, so they
+     too need the lock exclusively. */
+  bool extend = inode->length < offset + size;
+  bool exclusive = extend;
+  if (!exclusive) {
+    inode_lock_shared (inode);
+    size_t split = allocated_blocks (inode);
+    if (inode->length < offset + size) {
+      inode_unlock (inode);
+      extend = exclusive = true;
+    }
+    else if (class == BUFFER_DATA && !inode->inlined
+             && has_holes (inode, start, end < split ? end : split)) {
+      inode_unlock (inode);
+      exclusive = true;
+    }
+  }
+  if (exclusive)
+    inode_lock_exclusive (inode);
+
+  /* File data written through the cache is allocated sectors
+     later, in bigger runs. */
+  bool delay = extend && inode->length < offset + size
+               && caching != INODE_DIRECT && class == BUFFER_DATA
+               && !inode->inlined;
+  if (delay && !delay_blocks (inode, offset + size))
+    delay = flush_delayed (inode) && delay_blocks (inode, offset + size);
+
+  if (!delay && extend && inode->length < offset + size) {
+    /* The delayed data blocks come first. */
+    if (!flush_delayed (inode)) {
+      inode_unlock (inode);
+      return 0;
+    }
+
+    /* Sectors written directly in full need not be zeroed out
+       first. File data skipped over by the write is left as
+       holes. */
+    struct inode_disk *disk_inode = buffer_cache_get_exclusive (inode->sector,
+                                                                BUFFER_META);
+    struct alloc_aux alloc = {class, 0, 0, inode->sector + 1, 0,
+                              class == BUFFER_DATA ? start : 0, false};
+    if (caching == INODE_DIRECT) {
+      alloc.keep_start = DIV_ROUND_UP (offset, BLOCK_SECTOR_SIZE);
+      alloc.keep_end = (offset + size) / BLOCK_SECTOR_SIZE;
+    }
+
     /* Quit if there isn't enough space on disk. */
-    if (!extend_inode_length (disk_inode, offset + size))
+    if (!extend_inode_length (disk_inode, offset + size, &alloc)) {
+      buffer_cache_release (disk_inode, false);
+      inode_unlock (inode);
       return 0;
+    }
+    inode->length = disk_inode->length;
+    inode->inlined = disk_inode->inlined;
+    buffer_cache_release (disk_inode, true);
+    invalidate_extents (inode);
+  }
+
+  if (inode->inlined) {
+    struct inode_disk *disk_inode = buffer_cache_get_exclusive (inode->sector,
+                                                                BUFFER_META);
+    memcpy (disk_inode->data + offset, buffer_, size);
+    buffer_cache_release (disk_inode, true);
+    inode_unlock (inode);
+    return size;
+  }
+
+  /* Fill the holes written into. Sectors written in full are not
+     zeroed out first, since no reader can see them before the
+     write. */
+  size_t split = allocated_blocks (inode);
+  struct alloc_aux fill = {class, DIV_ROUND_UP (offset, BLOCK_SECTOR_SIZE),
+                           (offset + size) / BLOCK_SECTOR_SIZE,
+                           inode->sector + 1, 0, 0, false};
+  if (exclusive && class == BUFFER_DATA
+      && !fill_holes (inode, start, end < split ? end : split, &fill)) {
+    inode_unlock (inode);
+    return 0;
+  }
 
-  size_t start = offset / BLOCK_SECTOR_SIZE;
-  size_t end = DIV_ROUND_UP (offset + size, BLOCK_SECTOR_SIZE);
   struct buffer_aux *aux = malloc (sizeof (struct buffer_aux));
   aux->buffer = (void *) buffer_;
   aux->size = size;
   aux->offset = offset;
   aux->pos = 0;
-
-  inode_map_sectors (disk_inode, write_to_sectors, start, end, aux);
-  buffer_cache_release (disk_inode, true);
+  aux->class = class;
+  aux->caching = caching;
+
+  if (start < split)
+    inode_map_extents (inode, write_to_sectors, start,
+                       end < split ? end : split, aux);
+  if (end > split)
+    copy_delayed (inode, aux, true);
+  inode_unlock (inode);
   free (aux);
 
   return size;
 }
 
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
+   Returns the number of bytes actually written, which may be
+   less than SIZE if an error occurs. */
+off_t
+inode_write_at (struct inode *inode, const void *buffer, off_t size,
+                off_t offset)
+{
+  return inode_write_at_caching (inode, buffer, size, offset, INODE_CACHED);
+}
+
+/* Allocates sectors for the LENGTH bytes of INODE starting at
+   OFFSET ahead of time, in as few runs of consecutive sectors as
+   possible, so that writing them later takes no allocation.
+   Extends INODE if the bytes run past its end. Data blocks that
+   have sectors already keep them. Returns false if the range is
+   invalid, writes to INODE are denied or disk space runs out, in
+   which case INODE keeps its length. */
+bool
+inode_allocate (struct inode *inode, off_t offset, off_t length)
+{
+  if (offset < 0 || length <= 0 || offset > MAX_LENGTH - length
+      || inode->deny_write_cnt)
+    return false;
+
+  inode_lock_exclusive (inode);
+  bool success = flush_delayed (inode);
+  off_t old_length = inode->length;
+
+  size_t start = offset / BLOCK_SECTOR_SIZE;
+  size_t end = bytes_to_sectors (offset + length);
+  enum buffer_class class = data_class (inode->sector, inode->isdir);
+
+  /* New file data is left as holes, filled below along with the
+     holes INODE had. */
+  if (success && inode->length < offset + length) {
+    struct inode_disk *disk_inode = buffer_cache_get_exclusive (inode->sector,
+                                                                BUFFER_META);
+    struct alloc_aux alloc = {class, 0, 0, inode->sector + 1, 0,
+                              class == BUFFER_DATA ? end : 0, false};
+    success = extend_inode_length (disk_inode, offset + length, &alloc);
+    inode->length = disk_inode->length;
+    inode->inlined = disk_inode->inlined;
+    buffer_cache_release (disk_inode, true);
+    invalidate_extents (inode);
+  }
+
+  struct alloc_aux fill = {class, 0, 0, inode->sector + 1, 0, 0, true};
+  if (success && class == BUFFER_DATA && !inode->inlined)
+    success = fill_holes (inode, start, end, &fill);
+
+  /* Extending INODE takes no sectors for its new data blocks, so
+     it succeeds even when filling them in then fails. Take the
+     extension back, along with any sectors it got. */
+  if (!success && inode->length > old_length) {
+    struct inode_disk *disk_inode = buffer_cache_get_exclusive (inode->sector,
+                                                                BUFFER_META);
+    shorten_inode_length (disk_inode, old_length);
+    inode->length = disk_inode->length;
+    buffer_cache_release (disk_inode, true);
+    invalidate_extents (inode);
+  }
+  inode_unlock (inode);
+  return success;
+}
+
+/* Returns true if INODE's reader/writer lock could be acquired
+   for exclusive use without waiting, and if so acquires it. */
+static bool
+inode_try_lock_exclusive (struct inode *inode)
+{
+  bool success;
+
+  lock_acquire (&inode->rw_lock);
+  success = !inode->writer && inode->readers == 0;
+  if (success)
+    inode->writer = true;
+  lock_release (&inode->rw_lock);
+  return success;
+}
+
+/* Allocates sectors for the delayed data blocks of all open
+   inodes. Inodes in use are skipped unless WAIT is true. The
+   inodes are held open, but open_inodes_lock is not held, while
+   their blocks are allocated. */
+static void
+flush_open_inodes (bool wait)
+{
+  struct hash_iterator i;
+  struct list inodes;
+
+  list_init (&inodes);
+  lock_acquire (&flush_lock);
+  lock_acquire (&open_inodes_lock);
+  hash_first (&i, &open_inodes);
+  while (hash_next (&i)) {
+    struct inode *inode = hash_entry (hash_cur (&i), struct inode, elem);
+    if (inode->delayed_cnt > 0)
+      list_push_back (&inodes, &reopen_locked (inode)->flush_elem);
+  }
+  lock_release (&open_inodes_lock);
+
+  while (!list_empty (&inodes)) {
+    struct inode *inode = list_entry (list_pop_front (&inodes),
+                                      struct inode, flush_elem);
+    if (wait)
+      inode_lock_exclusive (inode);
+    if (wait || inode_try_lock_exclusive (inode)) {
+      flush_delayed (inode);
+      inode_unlock (inode);
+    }
+    inode_close (inode);
+  }
+  lock_release (&flush_lock);
+}
+
+/* Allocates sectors for the delayed data blocks of the open
+   inodes not in use, so that their data is written back along
+   with the rest of the buffer cache. Called at write-behind
+   time, so that data written to a file kept open does not stay
+   in memory for good. */
+void
+inode_flush (void)
+{
+  flush_open_inodes (false);
+}
+
+/* Allocates sectors for the delayed data blocks of all open
+   inodes, and frees those of the removed inodes not reclaimed
+   yet. */
+void
+inode_done (void)
+{
+  flush_open_inodes (true);
+
+  lock_acquire (&reclaiming_lock);
+  while (reclaim_next ())
+    continue;
+  lock_release (&reclaiming_lock);
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 void
@@ -442,72 +1944,84 @@ inode_allow_write (struct inode *inode)
 off_t
 inode_length (const struct inode *inode)
 {
-  struct inode_disk *data = buffer_cache_get (inode->sector);
-  off_t length = data->length;
-  buffer_cache_release (data, false);
-  return length;
+  return inode->length;
+}
+
+/* Returns true if SECTOR holds an inode, so that a sector reserved
+   for a system file can be checked before it is opened. */
+bool
+inode_valid (block_sector_t sector)
+{
+  struct inode_disk *disk_inode = buffer_cache_get_shared (sector,
+                                                           BUFFER_META);
+  bool valid = (disk_inode->magic == INODE_MAGIC
+                || disk_inode->magic == EXTENT_MAGIC);
+  buffer_cache_release (disk_inode, false);
+  return valid;
+}
+
+/* Returns true if INODE maps its data blocks with extents. */
+bool
+inode_has_extents (const struct inode *inode)
+{
+  return inode->has_extents;
 }
 
 /* Returns true if INODE is a directory, false otherwise. */
 bool
 inode_isdir (const struct inode *inode)
 {
-  struct inode_disk *disk_inode = buffer_cache_get (inode->sector);
-  bool isdir = disk_inode->isdir;
-  buffer_cache_release (disk_inode, false);
-  return isdir;
+  return inode->isdir;
 }
 
 /* Opens INODE's parent directory inode. */
 struct inode *
 inode_open_parent (struct inode *inode)
 {
-  if (inode != NULL) {
-    struct inode_disk *disk_inode = buffer_cache_get (inode->sector);
-    block_sector_t parent = disk_inode->parent;
-    buffer_cache_release (disk_inode, false);
-    inode = inode_open (parent);
-  }
+  if (inode != NULL)
+    inode = inode_open (inode->parent);
   return inode;
 }
 
 /* Returns the offset of INODE's entry in INODE's parent directory. */
 off_t
 inode_offset (const struct inode *inode) {
-  struct inode_disk *disk_inode = buffer_cache_get (inode->sector);
-  off_t ofs = disk_inode->ofs;
-  buffer_cache_release (disk_inode, false);
-  return ofs;
+  return inode->ofs;
 }
 
 /* Returns the number of subdirectories or files in INODE. */
 uint32_t
 inode_num_files (const struct inode *inode)
 {
-  struct inode_disk *disk_inode = buffer_cache_get (inode->sector);
-  uint32_t num_files = disk_inode->num_files;
-  buffer_cache_release (disk_inode, false);
-  return num_files;
+  return inode->num_files;
 }
 
 /* If PARENT is a directory, sets the parent and ofs
    members of the inode in CHILD SECTOR to PARENT and
    OFS. Increments the num_files of PARENT by one. */
 bool
-inode_add_file (const struct inode *parent, block_sector_t child_sector, off_t ofs)
+inode_add_file (struct inode *parent, block_sector_t child_sector, off_t ofs)
 {
   struct inode_disk *disk_inode;
+  struct inode *child;
 
   if (!inode_isdir (parent))
     return false;
 
-  disk_inode = buffer_cache_get (child_sector);
+  disk_inode = buffer_cache_get_exclusive (child_sector, BUFFER_META);
   disk_inode->parent = parent->sector;
   disk_inode->ofs = ofs;
+  lock_acquire (&open_inodes_lock);
+  child = find_open_inode (child_sector);
+  if (child != NULL) {
+    child->parent = parent->sector;
+    child->ofs = ofs;
+  }
+  lock_release (&open_inodes_lock);
   buffer_cache_release (disk_inode, true);
 
-  disk_inode = buffer_cache_get(parent->sector);
-  disk_inode->num_files += 1;
+  disk_inode = buffer_cache_get_exclusive (parent->sector, BUFFER_META);
+  parent->num_files = ++disk_inode->num_files;
   buffer_cache_release (disk_inode, true);
 
   return true;
@@ -515,39 +2029,140 @@ inode_add_file (const struct inode *parent, block_sector_t child_sector, off_t o
 
 /* Decrement num_files of INODE. */
 bool
-inode_remove_file (const struct inode *inode)
+inode_remove_file (struct inode *inode)
 {
   if (!inode_isdir (inode))
     return false;
 
-  struct inode_disk *disk_inode = buffer_cache_get(inode->sector);
-  disk_inode->num_files -= 1;
+  struct inode_disk *disk_inode = buffer_cache_get_exclusive (inode->sector,
+                                                              BUFFER_META);
+  inode->num_files = --disk_inode->num_files;
   buffer_cache_release (disk_inode, true);
   return true;
 }
 
+/* Returns a hash value for the inode containing E. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct inode, elem)->sector);
+}
+
+/* Returns true if the inode containing A precedes the inode
+   containing B. */
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return hash_entry (a, struct inode, elem)->sector
+         < hash_entry (b, struct inode, elem)->sector;
+}
+
 int
 get_open_cnt (const struct inode *inode) {
   return inode->open_cnt;
 }
 
-/* Allocates and zeros-out CNT new sectors.
-   Stores the sector numbers in SECTORS. */
+/* Allocates and zeros-out CNT new sectors, as described by the
+   struct alloc_aux pointed to by AUX.
+   Stores the sector numbers in SECTORS, or 0 for holes. */
 static bool
-allocate_sectors (size_t start UNUSED, block_sector_t *sectors,
-                  size_t cnt, void *aux UNUSED)
+allocate_sectors (size_t start, block_sector_t *sectors,
+                  size_t cnt, void *aux_)
 {
-  bool success = free_map_allocate_nc (cnt, sectors);
+  struct alloc_aux *aux = aux_;
+  size_t holes = 0;
+  while (holes < cnt && start + holes < aux->alloc_start)
+    sectors[holes++] = 0;
+  start += holes;
+  sectors += holes;
+  cnt -= holes;
+
+  bool success = cnt == 0 || free_map_allocate_nc (cnt, sectors);
   if (success) {
     void *zeros = calloc (BLOCK_SECTOR_SIZE, 1);
-    size_t i = 0;
-    while (i < cnt)
-      buffer_cache_write (sectors[i++], zeros);
+    size_t i;
+    for (i = 0; i < cnt; i++)
+      if (start + i < aux->keep_start || start + i >= aux->keep_end)
+        buffer_cache_write (sectors[i], zeros, aux->class);
     free (zeros);
   }
   return success;
 }
 
+/* Allocates and zeros-out sectors for the holes among the first
+   CNT sectors in SECTORS, as described by the struct alloc_aux
+   pointed to by AUX. Each run of holes is given consecutive
+   sectors following the sector before it where possible. Returns
+   false if memory or disk space runs out, in which case some of
+   the holes may have been filled. */
+static bool
+fill_hole_sectors (size_t start, block_sector_t *sectors,
+                   size_t cnt, void *aux_)
+{
+  struct alloc_aux *aux = aux_;
+  void *zeros = NULL;
+  size_t i = 0;
+  while (i < cnt) {
+    if (sectors[i] != 0) {
+      aux->goal = sectors[i++] + 1;
+      continue;
+    }
+
+    size_t holes = 1;
+    while (i + holes < cnt && sectors[i + holes] == 0)
+      holes++;
+    if (zeros == NULL) {
+      zeros = calloc (BLOCK_SECTOR_SIZE, 1);
+      if (zeros == NULL)
+        return false;
+    }
+    block_sector_t sector;
+    size_t n = aux->contiguous
+               ? free_map_allocate_run (holes, aux->goal, &sector)
+               : free_map_allocate_extent (holes, aux->goal, &sector);
+    if (n == 0) {
+      free (zeros);
+      return false;
+    }
+
+    for (; n > 0; n--, i++) {
+      sectors[i] = sector++;
+      if (start + i < aux->keep_start || start + i >= aux->keep_end)
+        buffer_cache_write (sectors[i], zeros, aux->class);
+    }
+    aux->goal = sector;
+  }
+  free (zeros);
+  return true;
+}
+
+/* Queues the first CNT sectors in SECTORS for read-ahead, as
+   sectors of the buffer cache class pointed to by AUX. */
+static bool
+prefetch_sectors (size_t start UNUSED, block_sector_t *sectors,
+                  size_t cnt, void *aux)
+{
+  enum buffer_class *class = aux;
+  size_t i;
+  for (i = 0; i < cnt; i++)
+    if (sectors[i] != 0)
+      buffer_cache_prefetch (sectors[i], *class, false);
+  return true;
+}
+
+/* Demotes the first CNT sectors in SECTORS in the buffer cache. */
+static bool
+demote_sectors (size_t start UNUSED, block_sector_t *sectors,
+                size_t cnt, void *aux UNUSED)
+{
+  size_t i;
+  for (i = 0; i < cnt; i++)
+    if (sectors[i] != 0)
+      buffer_cache_demote (sectors[i]);
+  return true;
+}
+
 /* Frees up the first CNT sectors in SECTORS. */
 static bool
 deallocate_sectors (size_t start UNUSED, block_sector_t *sectors,
@@ -557,6 +2172,31 @@ deallocate_sectors (size_t start UNUSED, block_sector_t *sectors,
   return true;
 }
 
+/* Caches the runs of consecutive sectors, and of holes, among the first CNT
+   sectors in SECTORS as extents of the inode described by the
+   struct extent_aux pointed to by AUX, starting at data block
+   START. Caches nothing more once the extent budget in AUX is
+   used up, which is not a failure. */
+static bool
+cache_extents (size_t start, block_sector_t *sectors,
+               size_t cnt, void *aux_)
+{
+  struct extent_aux *aux = aux_;
+  struct inode *inode = aux->inode;
+  size_t i = 0;
+
+  while (i < cnt && aux->left > 0) {
+    struct extent e = {start + i, sectors[i], 1};
+    while (i + e.cnt < cnt
+           && sectors[i + e.cnt] == (e.sector != 0 ? e.sector + e.cnt : 0))
+      e.cnt++;
+    i += e.cnt;
+    insert_extent (inode, &e);
+    aux->left--;
+  }
+  return true;
+}
+
 /* For your reference:
 
     struct buffer_aux {
@@ -564,6 +2204,8 @@ deallocate_sectors (size_t start UNUSED, block_sector_t *sectors,
       off_t size;
       off_t pos;
       off_t offset;
+      enum buffer_class class;
+      enum inode_caching caching;
     }
 */
 
@@ -592,10 +2234,21 @@ write_to_sectors (size_t start, block_sector_t *sectors,
     if (chunk_size <= 0)
       break;
 
-    /* Load sector into cache, then partially copy into caller's buffer. */
-    void *cache_block = buffer_cache_get (sector);
-    memcpy (cache_block + sector_ofs, aux->buffer + aux->pos, chunk_size);
-    buffer_cache_release (cache_block, true);
+    ASSERT (sector != 0);
+    if (aux->caching == INODE_DIRECT && chunk_size == BLOCK_SECTOR_SIZE)
+      buffer_cache_write_direct (sector, aux->buffer + aux->pos);
+    else {
+      /* Load sector into cache, then partially copy from caller's buffer.
+         There is no need to read a sector that is overwritten in full. */
+      void *cache_block = chunk_size == BLOCK_SECTOR_SIZE
+                          ? buffer_cache_get_for_overwrite (sector, aux->class)
+                          : buffer_cache_get_exclusive (sector, aux->class);
+      memcpy (cache_block + sector_ofs, aux->buffer + aux->pos, chunk_size);
+      if (aux->caching == INODE_NOREUSE)
+        buffer_cache_release_cold (cache_block, true);
+      else
+        buffer_cache_release (cache_block, true);
+    }
 
     /* Advance. */
     aux->offset += chunk_size;
@@ -630,10 +2283,20 @@ read_from_sectors (size_t start, block_sector_t *sectors,
     if (chunk_size <= 0)
       break;
 
-    /* Load sector into cache, then partially copy into caller's buffer. */
-    void *cache_block = buffer_cache_get (sector);
-    memcpy (aux->buffer + aux->pos, cache_block + sector_ofs, chunk_size);
-    buffer_cache_release (cache_block, false);
+    /* Holes read as zeros. */
+    if (sector == 0)
+      memset (aux->buffer + aux->pos, 0, chunk_size);
+    else if (aux->caching == INODE_DIRECT && chunk_size == BLOCK_SECTOR_SIZE)
+      buffer_cache_read_direct (sector, aux->buffer + aux->pos);
+    else {
+      /* Load sector into cache, then partially copy into caller's buffer. */
+      void *cache_block = buffer_cache_get_shared (sector, aux->class);
+      memcpy (aux->buffer + aux->pos, cache_block + sector_ofs, chunk_size);
+      if (aux->caching == INODE_NOREUSE)
+        buffer_cache_release_cold (cache_block, false);
+      else
+        buffer_cache_release (cache_block, false);
+    }
 
     /* Advance. */
     aux->offset += chunk_size;
@@ -7,7 +7,20 @@
 
 struct bitmap;
 
+/* How the data of a read or write is cached. */
+enum inode_caching
+  {
+    INODE_CACHED,               /* In the buffer cache. */
+    INODE_NOREUSE,              /* In the buffer cache, but evicted first. */
+    INODE_DIRECT                /* Whole sectors bypass the buffer cache. */
+  };
+
+/* True if new inodes map their data blocks with extents. */
+extern bool inode_use_extents;
+
 void inode_init (void);
+void inode_done (void);
+void inode_flush (void);
 bool inode_create (block_sector_t, off_t, bool);
 struct inode *inode_open (block_sector_t);
 struct inode *inode_reopen (struct inode *);
@@ -17,15 +30,24 @@ void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+off_t inode_read_at_caching (struct inode *, void *, off_t size,
+                             off_t offset, enum inode_caching);
+off_t inode_write_at_caching (struct inode *, const void *, off_t size,
+                              off_t offset, enum inode_caching);
+bool inode_allocate (struct inode *, off_t offset, off_t length);
+void inode_read_ahead (struct inode *, off_t offset, off_t size);
+void inode_demote (struct inode *, off_t offset, off_t size);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
 int get_open_cnt (const struct inode *);
 
+bool inode_valid (block_sector_t);
+bool inode_has_extents (const struct inode *);
 bool inode_isdir (const struct inode *);
 uint32_t inode_num_files (const struct inode *);
-bool inode_add_file (const struct inode *, block_sector_t, off_t);
-bool inode_remove_file (const struct inode *);
+bool inode_add_file (struct inode *, block_sector_t, off_t);
+bool inode_remove_file (struct inode *);
 off_t inode_offset (const struct inode *);
 
 #endif /* filesys/inode.h */
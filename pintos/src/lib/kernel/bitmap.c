@@ -379,6 +379,23 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the SIZE bytes of B starting at byte OFS to the same
+   bytes of FILE, which holds B as written by bitmap_write ().
+   Bytes past the end of B are ignored. Return true if
+   successful, false otherwise. */
+bool
+bitmap_write_part (const struct bitmap *b, struct file *file,
+                   size_t ofs, size_t size)
+{
+  size_t file_size = byte_cnt (b->bit_cnt);
+  if (ofs >= file_size)
+    return true;
+  if (size > file_size - ofs)
+    size = file_size - ofs;
+  return (size_t) file_write_at (file, (char *) b->bits + ofs,
+                                 size, ofs) == size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
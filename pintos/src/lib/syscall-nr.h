@@ -31,7 +31,47 @@ enum
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
     SYS_INUMBER,                /* Returns the inode number for a fd. */
     SYS_BUFFER_STAT,            /* Return Buffer Cache statistics */
-    SYS_BUFFER_RESET            /* Resets the Buffer Cache */
+    SYS_BUFFER_RESET,           /* Resets the Buffer Cache */
+    SYS_BUFFER_RESIZE,          /* Resizes the Buffer Cache */
+    SYS_OPEN_DIRECT,            /* Open a file for uncached I/O. */
+    SYS_FADVISE,                /* Declare a file's access pattern. */
+    SYS_FALLOCATE               /* Allocate disk space for a file. */
   };
 
+/* Statistics returned by SYS_BUFFER_STAT. */
+enum
+  {
+    BUFFER_STAT_MISSES,           /* Buffer cache misses. */
+    BUFFER_STAT_HITS,             /* Buffer cache hits. */
+    BUFFER_STAT_READS,            /* Block reads from the file system device. */
+    BUFFER_STAT_WRITES,           /* Block writes to the file system device. */
+    BUFFER_STAT_SHARDS,           /* Number of buffer cache shards. */
+    BUFFER_STAT_CLEAN_EVICTIONS,  /* Evictions that needed no write-back. */
+    BUFFER_STAT_DIRTY_EVICTIONS,  /* Evictions that wrote the victim back. */
+    BUFFER_STAT_SIZE,             /* Number of buffer cache blocks. */
+    BUFFER_STAT_PREFETCHES,       /* Sectors read ahead in the background. */
+    BUFFER_STAT_WAITS,            /* Waits for a locked cache entry. */
+    BUFFER_STAT_GHOST_HITS,       /* Misses on recently evicted sectors. */
+    BUFFER_STAT_DIRTY,            /* Dirty buffer cache blocks. */
+    BUFFER_STAT_DATA_MISSES,      /* Misses on file data. */
+    BUFFER_STAT_DATA_HITS,        /* Hits on file data. */
+    BUFFER_STAT_META_MISSES,      /* Misses on file system metadata. */
+    BUFFER_STAT_META_HITS,        /* Hits on file system metadata. */
+    BUFFER_STAT_DIRECT            /* Sectors transferred around the cache. */
+  };
+
+/* Advice for SYS_FADVISE. */
+enum
+  {
+    FADV_NORMAL,                  /* No particular access pattern. */
+    FADV_SEQUENTIAL,              /* File will be read sequentially. */
+    FADV_RANDOM,                  /* File will be read randomly. */
+    FADV_WILLNEED,                /* Range will be read soon. */
+    FADV_DONTNEED,                /* Range will not be read soon. */
+    FADV_NOREUSE                  /* File data will be used only once. */
+  };
+
+/* Restricts the buffer cache statistic STAT to shard SHARD. */
+#define BUFFER_STAT_SHARD(STAT, SHARD) ((STAT) | ((SHARD) + 1) << 8)
+
 #endif /* lib/syscall-nr.h */
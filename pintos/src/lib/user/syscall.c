@@ -61,6 +61,25 @@
           retval;                                               \
         })
 
+/* Invokes syscall NUMBER, passing arguments ARG0, ARG1, ARG2,
+   and ARG3, and returns the return value as an `int'. */
+#define syscall4(NUMBER, ARG0, ARG1, ARG2, ARG3)                \
+        ({                                                      \
+          int retval;                                           \
+          asm volatile                                          \
+            ("pushl %[arg3]; pushl %[arg2]; pushl %[arg1]; "    \
+             "pushl %[arg0]; "                                  \
+             "pushl %[number]; int $0x30; addl $20, %%esp"      \
+               : "=a" (retval)                                  \
+               : [number] "i" (NUMBER),                         \
+                 [arg0] "r" (ARG0),                             \
+                 [arg1] "r" (ARG1),                             \
+                 [arg2] "r" (ARG2),                             \
+                 [arg3] "r" (ARG3)                              \
+               : "memory");                                     \
+          retval;                                               \
+        })
+
 int
 practice (int i)
 {
@@ -200,3 +219,27 @@ buffer_reset()
 {
   syscall0 (SYS_BUFFER_RESET);
 }
+
+bool
+buffer_resize (int sectors)
+{
+  return syscall1 (SYS_BUFFER_RESIZE, sectors);
+}
+
+int
+open_direct (const char *file)
+{
+  return syscall1 (SYS_OPEN_DIRECT, file);
+}
+
+bool
+fadvise (int fd, unsigned offset, unsigned length, int advice)
+{
+  return syscall4 (SYS_FADVISE, fd, offset, length, advice);
+}
+
+bool
+fallocate (int fd, unsigned offset, unsigned length)
+{
+  return syscall3 (SYS_FALLOCATE, fd, offset, length);
+}
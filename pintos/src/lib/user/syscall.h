@@ -47,4 +47,8 @@ bool isdir (int fd);
 int inumber (int fd);
 int buffer_stat (int statnum);
 void buffer_reset (void);
+bool buffer_resize (int sectors);
+int open_direct (const char *file);
+bool fadvise (int fd, unsigned offset, unsigned length, int advice);
+bool fallocate (int fd, unsigned offset, unsigned length);
 #endif /* lib/user/syscall.h */
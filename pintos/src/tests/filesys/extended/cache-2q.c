@@ -0,0 +1,5 @@
+/* Reads random blocks of a file larger than the buffer cache
+   under 2Q. */
+
+#define GHOST_HITS true
+#include "tests/filesys/extended/cache-policy.inc"
@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(cache-2q) begin
+(cache-2q) create "a"
+(cache-2q) open "a"
+(cache-2q) write "a"
+(cache-2q) resetting buffer
+(cache-2q) read random blocks of "a"
+(cache-2q) close "a"
+(cache-2q) some misses were ghost hits
+(cache-2q) end
+EOF
+pass;
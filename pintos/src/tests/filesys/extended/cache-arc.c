@@ -0,0 +1,5 @@
+/* Reads random blocks of a file larger than the buffer cache
+   under ARC. */
+
+#define GHOST_HITS true
+#include "tests/filesys/extended/cache-policy.inc"
@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(cache-arc) begin
+(cache-arc) create "a"
+(cache-arc) open "a"
+(cache-arc) write "a"
+(cache-arc) resetting buffer
+(cache-arc) read random blocks of "a"
+(cache-arc) close "a"
+(cache-arc) some misses were ghost hits
+(cache-arc) end
+EOF
+pass;
@@ -0,0 +1,5 @@
+/* Reads random blocks of a file larger than the buffer cache
+   under the clock policy. */
+
+#define GHOST_HITS false
+#include "tests/filesys/extended/cache-policy.inc"
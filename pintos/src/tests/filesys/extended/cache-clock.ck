@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(cache-clock) begin
+(cache-clock) create "a"
+(cache-clock) open "a"
+(cache-clock) write "a"
+(cache-clock) resetting buffer
+(cache-clock) read random blocks of "a"
+(cache-clock) close "a"
+(cache-clock) no misses were ghost hits
+(cache-clock) end
+EOF
+pass;
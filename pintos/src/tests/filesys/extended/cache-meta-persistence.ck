@@ -0,0 +1,6 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_archive ({"d" => {"e" => {"f" => ['']}}, "big" => ["\0" x 65536]});
+pass;
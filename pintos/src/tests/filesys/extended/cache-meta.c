@@ -0,0 +1,70 @@
+/* Opens a file a few directories deep, streams a file larger
+   than the buffer cache, and opens the first file again,
+   checking that the stream did not push the directories and
+   inodes on the path out of the cache and that the hit and
+   miss counts of file data and metadata add up to the totals. */
+
+#include <syscall.h>
+#include <syscall-nr.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define BLOCK_SIZE 512
+#define NUM_BLOCKS 128
+static char buf[BLOCK_SIZE];
+
+void
+test_main (void)
+{
+  int fd;
+  int ret_val;
+  int meta_misses;
+  int i;
+
+  CHECK (mkdir ("d"), "mkdir \"d\"");
+  CHECK (mkdir ("d/e"), "mkdir \"d/e\"");
+  CHECK (create ("d/e/f", 0), "create \"d/e/f\"");
+  CHECK (create ("big", 0), "create \"big\"");
+  CHECK ((fd = open ("big")) > 1, "open \"big\"");
+  msg ("write \"big\"");
+  for (i = 0; i < NUM_BLOCKS; i++)
+    {
+      ret_val = write (fd, buf, BLOCK_SIZE);
+      if (ret_val != BLOCK_SIZE)
+        fail ("write %d bytes in \"big\" returned %d", BLOCK_SIZE, ret_val);
+    }
+
+  msg ("resetting buffer");
+  buffer_reset ();
+  msg ("open \"d/e/f\"");
+  close (open ("d/e/f"));
+  meta_misses = buffer_stat (BUFFER_STAT_META_MISSES);
+  CHECK (meta_misses > 0, "missed on metadata");
+
+  msg ("read \"big\"");
+  seek (fd, 0);
+  for (i = 0; i < NUM_BLOCKS; i++)
+    {
+      ret_val = read (fd, buf, BLOCK_SIZE);
+      if (ret_val != BLOCK_SIZE)
+        fail ("read %d bytes in \"big\" returned %d", BLOCK_SIZE, ret_val);
+    }
+  CHECK (buffer_stat (BUFFER_STAT_DATA_MISSES) > 0, "missed on file data");
+
+  msg ("open \"d/e/f\" again");
+  meta_misses = buffer_stat (BUFFER_STAT_META_MISSES);
+  close (open ("d/e/f"));
+  CHECK (buffer_stat (BUFFER_STAT_META_MISSES) == meta_misses,
+         "no more misses on metadata");
+  CHECK (buffer_stat (BUFFER_STAT_DATA_HITS)
+         + buffer_stat (BUFFER_STAT_META_HITS)
+         == buffer_stat (BUFFER_STAT_HITS),
+         "data and metadata hits add up to the total");
+  CHECK (buffer_stat (BUFFER_STAT_DATA_MISSES)
+         + buffer_stat (BUFFER_STAT_META_MISSES)
+         == buffer_stat (BUFFER_STAT_MISSES),
+         "data and metadata misses add up to the total");
+
+  msg ("close \"big\"");
+  close (fd);
+}
@@ -0,0 +1,25 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(cache-meta) begin
+(cache-meta) mkdir "d"
+(cache-meta) mkdir "d/e"
+(cache-meta) create "d/e/f"
+(cache-meta) create "big"
+(cache-meta) open "big"
+(cache-meta) write "big"
+(cache-meta) resetting buffer
+(cache-meta) open "d/e/f"
+(cache-meta) missed on metadata
+(cache-meta) read "big"
+(cache-meta) missed on file data
+(cache-meta) open "d/e/f" again
+(cache-meta) no more misses on metadata
+(cache-meta) data and metadata hits add up to the total
+(cache-meta) data and metadata misses add up to the total
+(cache-meta) close "big"
+(cache-meta) end
+EOF
+pass;
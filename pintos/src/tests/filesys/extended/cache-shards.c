@@ -0,0 +1,68 @@
+/* Reads a file that is not cached and checks that the buffer
+   cache's per-shard hit and miss counts add up to its totals,
+   with the misses spread over more than one shard. */
+
+#include <random.h>
+#include <syscall.h>
+#include <syscall-nr.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define BLOCK_SIZE 512
+#define NUM_BLOCKS 32
+static char buf_a[BLOCK_SIZE];
+
+void
+test_main (void)
+{
+  int fd;
+  int ret_val;
+  int shards, busy;
+  int hits, misses;
+  int i;
+
+  random_init (0);
+  random_bytes (buf_a, sizeof buf_a);
+  CHECK (create ("a", 0), "create \"a\"");
+  CHECK ((fd = open ("a")) > 1, "open \"a\"");
+  msg ("creating a");
+  for (i = 0; i < NUM_BLOCKS; i++)
+    {
+      ret_val = write (fd, buf_a, BLOCK_SIZE);
+      if (ret_val != BLOCK_SIZE)
+        fail ("write %d bytes in \"a\" returned %d", BLOCK_SIZE, ret_val);
+    }
+
+  msg ("resetting buffer");
+  buffer_reset ();
+  msg ("read \"a\"");
+  seek (fd, 0);
+  for (i = 0; i < NUM_BLOCKS; i++)
+    {
+      ret_val = read (fd, buf_a, BLOCK_SIZE);
+      if (ret_val != BLOCK_SIZE)
+        fail ("read %d bytes in \"a\" returned %d", BLOCK_SIZE, ret_val);
+    }
+
+  shards = buffer_stat (BUFFER_STAT_SHARDS);
+  CHECK (shards > 1, "buffer cache has more than one shard");
+
+  hits = misses = busy = 0;
+  for (i = 0; i < shards; i++)
+    {
+      int shard_misses = buffer_stat (BUFFER_STAT_SHARD (BUFFER_STAT_MISSES,
+                                                         i));
+      hits += buffer_stat (BUFFER_STAT_SHARD (BUFFER_STAT_HITS, i));
+      misses += shard_misses;
+      if (shard_misses > 0)
+        busy++;
+    }
+  CHECK (hits == buffer_stat (BUFFER_STAT_HITS)
+         && misses == buffer_stat (BUFFER_STAT_MISSES),
+         "per-shard counts add up to the totals");
+  CHECK (busy > 1, "misses spread over more than one shard");
+
+  msg ("close \"a\"");
+  close (fd);
+  remove ("a");
+}
@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(cache-shards) begin
+(cache-shards) create "a"
+(cache-shards) open "a"
+(cache-shards) creating a
+(cache-shards) resetting buffer
+(cache-shards) read "a"
+(cache-shards) buffer cache has more than one shard
+(cache-shards) per-shard counts add up to the totals
+(cache-shards) misses spread over more than one shard
+(cache-shards) close "a"
+(cache-shards) end
+EOF
+pass;
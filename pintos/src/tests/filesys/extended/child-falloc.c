@@ -0,0 +1,46 @@
+/* Child process for fallocate-race.
+   Tries to write one block at the end of a file on a full disk,
+   while our parent process calls fallocate () past its end,
+   which fails and takes the extension back. Each write needs a
+   new sector, so each must fail, however it interleaves with
+   our parent's calls. */
+
+#include <stdlib.h>
+#include <syscall.h>
+#include "tests/filesys/extended/fallocate-race.h"
+#include "tests/lib.h"
+
+const char *test_name = "child-falloc";
+
+static char buf[BLOCK_SIZE];
+
+int
+main (int argc, const char *argv[])
+{
+  int child_idx;
+  int fd;
+  int length;
+  int i;
+
+  quiet = true;
+
+  CHECK (argc == 2, "argc must be 2, actually %d", argc);
+  child_idx = atoi (argv[1]);
+
+  CHECK ((fd = open_direct (file_name)) > 1, "open \"%s\" for direct I/O",
+         file_name);
+  length = filesize (fd);
+  for (i = 0; i < TRY_CNT; i++)
+    {
+      int ret_val;
+
+      seek (fd, length);
+      ret_val = write (fd, buf, BLOCK_SIZE);
+      if (ret_val != 0)
+        fail ("write %d bytes at end of \"%s\" on a full disk returned %d",
+              BLOCK_SIZE, file_name, ret_val);
+    }
+  close (fd);
+
+  return child_idx;
+}
@@ -0,0 +1,89 @@
+/* Writes a file through the buffer cache and reads it back
+   through a file opened with open_direct (), and the other way
+   around, checking that each sees the data the other wrote
+   whether or not it is still cached. */
+
+#include <random.h>
+#include <syscall.h>
+#include <syscall-nr.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define BLOCK_SIZE 512
+#define NUM_BLOCKS 16
+static char buf_a[BLOCK_SIZE * NUM_BLOCKS];
+static char buf_b[BLOCK_SIZE * NUM_BLOCKS];
+static char buf_r[BLOCK_SIZE * NUM_BLOCKS];
+
+/* Writes all of BUF to FD, starting at its beginning. */
+static void
+write_all (int fd, const char *buf)
+{
+  int ret_val;
+
+  seek (fd, 0);
+  ret_val = write (fd, buf, BLOCK_SIZE * NUM_BLOCKS);
+  if (ret_val != BLOCK_SIZE * NUM_BLOCKS)
+    fail ("write %d bytes in \"a\" returned %d",
+          BLOCK_SIZE * NUM_BLOCKS, ret_val);
+}
+
+/* Reads all of FD back and compares it with EXPECTED. */
+static void
+read_back (int fd, const char *expected)
+{
+  int ret_val;
+
+  seek (fd, 0);
+  ret_val = read (fd, buf_r, sizeof buf_r);
+  if (ret_val != (int) sizeof buf_r)
+    fail ("read %zu bytes in \"a\" returned %d", sizeof buf_r, ret_val);
+  compare_bytes (buf_r, expected, sizeof buf_r, 0, "a");
+}
+
+void
+test_main (void)
+{
+  int fd, dfd;
+
+  random_init (0);
+  random_bytes (buf_a, sizeof buf_a);
+  random_bytes (buf_b, sizeof buf_b);
+  CHECK (create ("a", 0), "create \"a\"");
+  CHECK ((fd = open ("a")) > 1, "open \"a\"");
+  CHECK ((dfd = open_direct ("a")) > 1, "open \"a\" for direct I/O");
+
+  msg ("write \"a\" through the cache");
+  write_all (fd, buf_a);
+  msg ("read \"a\" directly while it is cached");
+  read_back (dfd, buf_a);
+
+  msg ("resetting buffer");
+  buffer_reset ();
+  msg ("read \"a\" directly while it is not cached");
+  read_back (dfd, buf_a);
+  CHECK (buffer_stat (BUFFER_STAT_DIRECT) == NUM_BLOCKS,
+         "read %d sectors around the cache", NUM_BLOCKS);
+  CHECK (buffer_stat (BUFFER_STAT_DATA_MISSES) == 0,
+         "cached no file data");
+
+  msg ("write \"a\" directly while it is not cached");
+  write_all (dfd, buf_b);
+  msg ("read \"a\" through the cache");
+  read_back (fd, buf_b);
+
+  msg ("write \"a\" directly while it is cached");
+  write_all (dfd, buf_a);
+  msg ("read \"a\" through the cache");
+  read_back (fd, buf_a);
+
+  msg ("resetting buffer");
+  buffer_reset ();
+  msg ("read \"a\" directly");
+  read_back (dfd, buf_a);
+
+  msg ("close \"a\"");
+  close (dfd);
+  close (fd);
+  remove ("a");
+}
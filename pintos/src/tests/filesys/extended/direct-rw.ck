@@ -0,0 +1,25 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(direct-rw) begin
+(direct-rw) create "a"
+(direct-rw) open "a"
+(direct-rw) open "a" for direct I/O
+(direct-rw) write "a" through the cache
+(direct-rw) read "a" directly while it is cached
+(direct-rw) resetting buffer
+(direct-rw) read "a" directly while it is not cached
+(direct-rw) read 16 sectors around the cache
+(direct-rw) cached no file data
+(direct-rw) write "a" directly while it is not cached
+(direct-rw) read "a" through the cache
+(direct-rw) write "a" directly while it is cached
+(direct-rw) read "a" through the cache
+(direct-rw) resetting buffer
+(direct-rw) read "a" directly
+(direct-rw) close "a"
+(direct-rw) end
+EOF
+pass;
@@ -0,0 +1,89 @@
+/* Checks that fadvise () rejects invalid advice and ranges, and
+   that FADV_WILLNEED raises the buffer cache hit rate of reading
+   a file that is not cached. */
+
+#include <random.h>
+#include <syscall.h>
+#include <syscall-nr.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define BLOCK_SIZE 512
+#define NUM_BLOCKS 32
+static char buf_a[BLOCK_SIZE];
+
+/* Reads all of FD and returns the number of buffer cache hits on
+   file data that took. */
+static int
+read_hits (int fd)
+{
+  int old_hits = buffer_stat (BUFFER_STAT_DATA_HITS);
+  int ret_val;
+  int i;
+
+  seek (fd, 0);
+  for (i = 0; i < NUM_BLOCKS; i++)
+    {
+      ret_val = read (fd, buf_a, BLOCK_SIZE);
+      if (ret_val != BLOCK_SIZE)
+        fail ("read %d bytes in \"a\" returned %d", BLOCK_SIZE, ret_val);
+    }
+  return buffer_stat (BUFFER_STAT_DATA_HITS) - old_hits;
+}
+
+void
+test_main (void)
+{
+  int fd;
+  int ret_val;
+  int cold_hits, warm_hits;
+  int i;
+
+  random_init (0);
+  random_bytes (buf_a, sizeof buf_a);
+  CHECK (create ("a", 0), "create \"a\"");
+  CHECK ((fd = open ("a")) > 1, "open \"a\"");
+  msg ("creating a");
+  for (i = 0; i < NUM_BLOCKS; i++)
+    {
+      ret_val = write (fd, buf_a, BLOCK_SIZE);
+      if (ret_val != BLOCK_SIZE)
+        fail ("write %d bytes in \"a\" returned %d", BLOCK_SIZE, ret_val);
+    }
+
+  CHECK (!fadvise (fd, 0, 0, FADV_NOREUSE + 1), "reject unknown advice");
+  CHECK (!fadvise (fd, 0, 0, -1), "reject negative advice");
+  CHECK (!fadvise (fd, 0x80000000, 0, FADV_WILLNEED),
+         "reject offset past 2 GB");
+  CHECK (!fadvise (fd, 0, 0x80000000, FADV_DONTNEED),
+         "reject length past 2 GB");
+  CHECK (fadvise (fd, BLOCK_SIZE * NUM_BLOCKS * 2, BLOCK_SIZE, FADV_WILLNEED),
+         "accept range past end of file");
+
+  /* Random access turns off the file's own read-ahead, so that
+     only FADV_WILLNEED reads ahead below. */
+  CHECK (fadvise (fd, 0, 0, FADV_RANDOM), "advise random access");
+
+  msg ("resetting buffer");
+  buffer_reset ();
+  msg ("read \"a\"");
+  cold_hits = read_hits (fd);
+
+  msg ("resetting buffer");
+  buffer_reset ();
+  CHECK (fadvise (fd, 0, 0, FADV_WILLNEED), "advise \"a\" will be needed");
+  msg ("read \"a\"");
+  warm_hits = read_hits (fd);
+  CHECK (buffer_stat (BUFFER_STAT_PREFETCHES) > 0,
+         "read \"a\" ahead in the background");
+
+  msg ("close \"a\"");
+  close (fd);
+  remove ("a");
+
+  if (warm_hits > cold_hits)
+    msg ("Hit count after FADV_WILLNEED is greater than without it");
+  else
+    fail ("%d hits after FADV_WILLNEED, %d without it",
+          warm_hits, cold_hits);
+}
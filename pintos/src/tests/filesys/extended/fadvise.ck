@@ -0,0 +1,26 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fadvise) begin
+(fadvise) create "a"
+(fadvise) open "a"
+(fadvise) creating a
+(fadvise) reject unknown advice
+(fadvise) reject negative advice
+(fadvise) reject offset past 2 GB
+(fadvise) reject length past 2 GB
+(fadvise) accept range past end of file
+(fadvise) advise random access
+(fadvise) resetting buffer
+(fadvise) read "a"
+(fadvise) resetting buffer
+(fadvise) advise "a" will be needed
+(fadvise) read "a"
+(fadvise) read "a" ahead in the background
+(fadvise) close "a"
+(fadvise) Hit count after FADV_WILLNEED is greater than without it
+(fadvise) end
+EOF
+pass;
@@ -0,0 +1,6 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_archive ({"a" => ["x" x 2560, "\0" x 7680, "x" x 2560]});
+pass;
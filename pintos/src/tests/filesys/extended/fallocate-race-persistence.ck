@@ -0,0 +1,6 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_archive ({"child-falloc" => "tests/filesys/extended/child-falloc"});
+pass;
@@ -0,0 +1,55 @@
+/* Calls fallocate () past the end of a file on a full disk,
+   which fails and takes the extension back, while a subprocess
+   tries to write at the end of the same file. The writes must
+   fail too, instead of going to blocks past the end of the file
+   as it shrinks back under them. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/filesys/extended/fallocate-race.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[BLOCK_SIZE];
+
+void
+test_main (void)
+{
+  pid_t child;
+  int fd, fill_fd;
+  int length;
+  int i;
+
+  memset (buf, 'x', sizeof buf);
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open_direct (file_name)) > 1, "open \"%s\" for direct I/O",
+         file_name);
+
+  /* Fill the disk, and then "a", so that no single sector is
+     left over for the child's writes. */
+  CHECK (create ("b", 0), "create \"b\"");
+  CHECK ((fill_fd = open_direct ("b")) > 1, "open \"b\" for direct I/O");
+  msg ("fill the disk with \"b\" and \"%s\"", file_name);
+  while (write (fill_fd, buf, BLOCK_SIZE) == BLOCK_SIZE)
+    continue;
+  while (write (fd, buf, BLOCK_SIZE) == BLOCK_SIZE)
+    continue;
+  length = filesize (fd);
+
+  exec_children ("child-falloc", &child, 1);
+  msg ("fallocate past end of \"%s\" while the child writes there",
+       file_name);
+  for (i = 0; i < TRY_CNT; i++)
+    if (fallocate (fd, length, 16 * BLOCK_SIZE))
+      fail ("fallocate at end of \"%s\" on a full disk succeeded",
+            file_name);
+  wait_children (&child, 1);
+  CHECK (filesize (fd) == length, "size of \"%s\" is unchanged", file_name);
+
+  msg ("close \"b\"");
+  close (fill_fd);
+  CHECK (remove ("b"), "remove \"b\"");
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  CHECK (remove (file_name), "remove \"%s\"", file_name);
+}
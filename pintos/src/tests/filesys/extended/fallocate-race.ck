@@ -0,0 +1,22 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fallocate-race) begin
+(fallocate-race) create "a"
+(fallocate-race) open "a" for direct I/O
+(fallocate-race) create "b"
+(fallocate-race) open "b" for direct I/O
+(fallocate-race) fill the disk with "b" and "a"
+(fallocate-race) exec child 1 of 1: "child-falloc 0"
+(fallocate-race) fallocate past end of "a" while the child writes there
+(fallocate-race) wait for child 1 of 1 returned 0 (expected 0)
+(fallocate-race) size of "a" is unchanged
+(fallocate-race) close "b"
+(fallocate-race) remove "b"
+(fallocate-race) close "a"
+(fallocate-race) remove "a"
+(fallocate-race) end
+EOF
+pass;
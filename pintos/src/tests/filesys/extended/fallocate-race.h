@@ -0,0 +1,8 @@
+#ifndef TESTS_FILESYS_EXTENDED_FALLOCATE_RACE_H
+#define TESTS_FILESYS_EXTENDED_FALLOCATE_RACE_H
+
+#define BLOCK_SIZE 512
+#define TRY_CNT 256
+static const char file_name[] = "a";
+
+#endif /* tests/filesys/extended/fallocate-race.h */
@@ -0,0 +1,101 @@
+/* Allocates sectors with fallocate () for part of a hole in a
+   file and past its end, fills up the disk, and checks that the
+   allocated blocks can still be written while fallocate () of
+   more blocks fails until space is freed. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define BLOCK_SIZE 512
+static char buf_x[BLOCK_SIZE * 5];
+static char zeros[BLOCK_SIZE * 5];
+static char buf_r[BLOCK_SIZE * 5];
+
+/* Writes SIZE bytes of BUF to FD at OFS, failing unless all of
+   them were written. */
+static void
+write_at (int fd, const char *buf, int size, int ofs)
+{
+  int ret_val;
+
+  seek (fd, ofs);
+  ret_val = write (fd, buf, size);
+  if (ret_val != size)
+    fail ("write %d bytes at %d in \"a\" returned %d", size, ofs, ret_val);
+}
+
+/* Reads SIZE bytes of FD at OFS and compares them with
+   EXPECTED. */
+static void
+read_at (int fd, const char *expected, int size, int ofs)
+{
+  int ret_val;
+
+  seek (fd, ofs);
+  ret_val = read (fd, buf_r, size);
+  if (ret_val != size)
+    fail ("read %d bytes at %d in \"a\" returned %d", size, ofs, ret_val);
+  compare_bytes (buf_r, expected, size, ofs, "a");
+}
+
+void
+test_main (void)
+{
+  int fd, fill_fd;
+  int ret_val;
+  int i;
+
+  memset (buf_x, 'x', sizeof buf_x);
+
+  /* Direct writes leave the data they skip over as holes. */
+  CHECK (create ("a", 0), "create \"a\"");
+  CHECK ((fd = open_direct ("a")) > 1, "open \"a\" for direct I/O");
+  msg ("write block 20 of \"a\"");
+  write_at (fd, buf_x, BLOCK_SIZE, 20 * BLOCK_SIZE);
+
+  CHECK (!fallocate (fd, 0, 0), "reject empty range");
+  CHECK (!fallocate (fd, 0x80000000, BLOCK_SIZE), "reject offset past 2 GB");
+
+  CHECK (fallocate (fd, 0, 5 * BLOCK_SIZE), "fallocate blocks 0-4 of hole");
+  CHECK (filesize (fd) == 21 * BLOCK_SIZE, "size of \"a\" is unchanged");
+  msg ("read blocks 0-19 of \"a\"");
+  for (i = 0; i < 20; i += 5)
+    read_at (fd, zeros, 5 * BLOCK_SIZE, i * BLOCK_SIZE);
+
+  CHECK (fallocate (fd, 21 * BLOCK_SIZE, 4 * BLOCK_SIZE),
+         "fallocate blocks 21-24 at end of file");
+  CHECK (filesize (fd) == 25 * BLOCK_SIZE, "size of \"a\" is 25 blocks");
+  msg ("read blocks 20-24 of \"a\"");
+  read_at (fd, buf_x, BLOCK_SIZE, 20 * BLOCK_SIZE);
+  read_at (fd, zeros, 4 * BLOCK_SIZE, 21 * BLOCK_SIZE);
+
+  CHECK (create ("b", 0), "create \"b\"");
+  CHECK ((fill_fd = open_direct ("b")) > 1, "open \"b\" for direct I/O");
+  msg ("fill the disk with \"b\"");
+  do
+    ret_val = write (fill_fd, buf_x, BLOCK_SIZE);
+  while (ret_val == BLOCK_SIZE);
+
+  msg ("write allocated blocks of \"a\" on a full disk");
+  write_at (fd, buf_x, 5 * BLOCK_SIZE, 0);
+  write_at (fd, buf_x, 4 * BLOCK_SIZE, 21 * BLOCK_SIZE);
+  CHECK (!fallocate (fd, 5 * BLOCK_SIZE, 15 * BLOCK_SIZE),
+         "fallocate blocks 5-19 of hole on a full disk fails");
+  CHECK (!fallocate (fd, 25 * BLOCK_SIZE, 16 * BLOCK_SIZE),
+         "fallocate at end of file on a full disk fails");
+  CHECK (filesize (fd) == 25 * BLOCK_SIZE, "size of \"a\" is unchanged");
+
+  msg ("close \"b\"");
+  close (fill_fd);
+  CHECK (remove ("b"), "remove \"b\"");
+  CHECK (fallocate (fd, 5 * BLOCK_SIZE, 15 * BLOCK_SIZE),
+         "fallocate blocks 5-19 of hole");
+  msg ("read blocks 0-9 of \"a\"");
+  read_at (fd, buf_x, 5 * BLOCK_SIZE, 0);
+  read_at (fd, zeros, 5 * BLOCK_SIZE, 5 * BLOCK_SIZE);
+
+  msg ("close \"a\"");
+  close (fd);
+}
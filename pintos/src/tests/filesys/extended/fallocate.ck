@@ -0,0 +1,32 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fallocate) begin
+(fallocate) create "a"
+(fallocate) open "a" for direct I/O
+(fallocate) write block 20 of "a"
+(fallocate) reject empty range
+(fallocate) reject offset past 2 GB
+(fallocate) fallocate blocks 0-4 of hole
+(fallocate) size of "a" is unchanged
+(fallocate) read blocks 0-19 of "a"
+(fallocate) fallocate blocks 21-24 at end of file
+(fallocate) size of "a" is 25 blocks
+(fallocate) read blocks 20-24 of "a"
+(fallocate) create "b"
+(fallocate) open "b" for direct I/O
+(fallocate) fill the disk with "b"
+(fallocate) write allocated blocks of "a" on a full disk
+(fallocate) fallocate blocks 5-19 of hole on a full disk fails
+(fallocate) fallocate at end of file on a full disk fails
+(fallocate) size of "a" is unchanged
+(fallocate) close "b"
+(fallocate) remove "b"
+(fallocate) fallocate blocks 5-19 of hole
+(fallocate) read blocks 0-9 of "a"
+(fallocate) close "a"
+(fallocate) end
+EOF
+pass;
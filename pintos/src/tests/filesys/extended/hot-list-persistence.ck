@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_archive ({"a" => ["h" x 16384]});
+
+# The boot must have queued the sectors cached at the last
+# shutdown, no more than the 64 sectors of the default cache,
+# and read at least those from the file system device.
+my (@output) = read_text_file ("$test.output");
+my ($queued) = map (/Loading hot sectors\.\.\.(\d+) queued\./, @output);
+fail "Hot sector list was not loaded.\n" if !defined $queued;
+fail "Queued $queued hot sectors for a 64-sector cache.\n"
+  if $queued == 0 || $queued > 64;
+my ($reads) = map (/\(filesys\): (\d+) reads/, @output);
+fail "No read count for the file system device.\n" if !defined $reads;
+fail "Read $reads sectors but queued $queued hot sectors.\n"
+  if $reads < $queued;
+pass;
@@ -0,0 +1,32 @@
+/* Writes a file and reads it back, so that its blocks are in the
+   buffer cache at shutdown. The persistence check then expects
+   the next boot to load the hot sector list saved at shutdown
+   and to read no more sectors from it than the cache holds. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define BLOCK_SIZE 512
+#define BLOCK_CNT 32
+static char buf[BLOCK_SIZE * BLOCK_CNT];
+
+void
+test_main (void)
+{
+  int fd;
+  int ret_val;
+
+  memset (buf, 'h', sizeof buf);
+  CHECK (create ("a", 0), "create \"a\"");
+  CHECK ((fd = open ("a")) > 1, "open \"a\"");
+  msg ("write %d blocks in \"a\"", BLOCK_CNT);
+  ret_val = write (fd, buf, sizeof buf);
+  if (ret_val != (int) sizeof buf)
+    fail ("write %zu bytes in \"a\" returned %d", sizeof buf, ret_val);
+  seek (fd, 0);
+  check_file_handle (fd, "a", buf, sizeof buf);
+  msg ("close \"a\"");
+  close (fd);
+}
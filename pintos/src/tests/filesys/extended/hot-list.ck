@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(hot-list) begin
+(hot-list) create "a"
+(hot-list) open "a"
+(hot-list) write 32 blocks in "a"
+(hot-list) verified contents of "a"
+(hot-list) close "a"
+(hot-list) end
+EOF
+pass;
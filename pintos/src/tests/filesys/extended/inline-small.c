@@ -0,0 +1,49 @@
+/* Writes a file small enough to be held in its inode and checks
+   that reading it back touches no file data in the buffer
+   cache, then grows it past the size that fits and checks that
+   all of it reads back. */
+
+#include <string.h>
+#include <syscall.h>
+#include <syscall-nr.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SMALL_SIZE 100
+#define LARGE_SIZE 1100
+static char buf[LARGE_SIZE];
+
+void
+test_main (void)
+{
+  int fd;
+  int ret_val;
+
+  memset (buf, 'i', sizeof buf);
+  CHECK (create ("a", 0), "create \"a\"");
+  CHECK ((fd = open ("a")) > 1, "open \"a\"");
+  msg ("write %d bytes in \"a\"", SMALL_SIZE);
+  ret_val = write (fd, buf, SMALL_SIZE);
+  if (ret_val != SMALL_SIZE)
+    fail ("write %d bytes in \"a\" returned %d", SMALL_SIZE, ret_val);
+
+  msg ("resetting buffer");
+  buffer_reset ();
+  seek (fd, 0);
+  check_file_handle (fd, "a", buf, SMALL_SIZE);
+  CHECK (buffer_stat (BUFFER_STAT_DATA_MISSES) == 0
+         && buffer_stat (BUFFER_STAT_DATA_HITS) == 0,
+         "read \"a\" without touching file data blocks");
+
+  msg ("write \"a\" up to %d bytes", LARGE_SIZE);
+  ret_val = write (fd, buf + SMALL_SIZE, LARGE_SIZE - SMALL_SIZE);
+  if (ret_val != LARGE_SIZE - SMALL_SIZE)
+    fail ("write %d bytes in \"a\" returned %d",
+          LARGE_SIZE - SMALL_SIZE, ret_val);
+  msg ("resetting buffer");
+  buffer_reset ();
+  seek (fd, 0);
+  check_file_handle (fd, "a", buf, LARGE_SIZE);
+  msg ("close \"a\"");
+  close (fd);
+}
@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(inline-small) begin
+(inline-small) create "a"
+(inline-small) open "a"
+(inline-small) write 100 bytes in "a"
+(inline-small) resetting buffer
+(inline-small) verified contents of "a"
+(inline-small) read "a" without touching file data blocks
+(inline-small) write "a" up to 1100 bytes
+(inline-small) resetting buffer
+(inline-small) verified contents of "a"
+(inline-small) close "a"
+(inline-small) end
+EOF
+pass;
@@ -0,0 +1,46 @@
+/* Fills the disk with one file, removes it, and at once writes
+   as much into another file, checking that the writes wait for
+   the space of the removed file to be freed instead of
+   failing. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define BLOCK_SIZE 512
+static char buf[BLOCK_SIZE];
+
+void
+test_main (void)
+{
+  int fd;
+  int ret_val;
+  int cnt, i;
+
+  memset (buf, 'a', sizeof buf);
+  CHECK (create ("a", 0), "create \"a\"");
+  CHECK ((fd = open ("a")) > 1, "open \"a\"");
+  msg ("fill the disk with \"a\"");
+  for (cnt = 0; write (fd, buf, BLOCK_SIZE) == BLOCK_SIZE; cnt++)
+    continue;
+  CHECK (cnt > 0, "wrote some blocks in \"a\"");
+  msg ("close \"a\"");
+  close (fd);
+  CHECK (remove ("a"), "remove \"a\"");
+
+  memset (buf, 'b', sizeof buf);
+  CHECK (create ("b", 0), "create \"b\"");
+  CHECK ((fd = open ("b")) > 1, "open \"b\"");
+  msg ("write as many blocks in \"b\"");
+  for (i = 0; i < cnt; i++)
+    {
+      ret_val = write (fd, buf, BLOCK_SIZE);
+      if (ret_val != BLOCK_SIZE)
+        fail ("write %d bytes at offset %d in \"b\" returned %d",
+              BLOCK_SIZE, i * BLOCK_SIZE, ret_val);
+    }
+  msg ("close \"b\"");
+  close (fd);
+  CHECK (remove ("b"), "remove \"b\"");
+}
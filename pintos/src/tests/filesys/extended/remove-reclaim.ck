@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(remove-reclaim) begin
+(remove-reclaim) create "a"
+(remove-reclaim) open "a"
+(remove-reclaim) fill the disk with "a"
+(remove-reclaim) wrote some blocks in "a"
+(remove-reclaim) close "a"
+(remove-reclaim) remove "a"
+(remove-reclaim) create "b"
+(remove-reclaim) open "b"
+(remove-reclaim) write as many blocks in "b"
+(remove-reclaim) close "b"
+(remove-reclaim) remove "b"
+(remove-reclaim) end
+EOF
+pass;
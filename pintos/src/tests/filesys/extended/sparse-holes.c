@@ -0,0 +1,68 @@
+/* Writes a block 1 MB into an empty file and checks that the
+   hole before it reads back as zeros without reading the disk
+   and that it takes no sectors, by then writing a second file
+   that only fits on the disk if it does not. */
+
+#include <string.h>
+#include <syscall.h>
+#include <syscall-nr.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define BLOCK_SIZE 512
+#define HOLE_SIZE (1024 * 1024)
+#define READ_SIZE (64 * 1024)
+#define B_SIZE (1280 * 1024)
+static char buf[READ_SIZE];
+static char zeros[READ_SIZE];
+
+void
+test_main (void)
+{
+  int fd;
+  int ret_val;
+  int reads;
+  int i;
+
+  CHECK (create ("a", 0), "create \"a\"");
+  CHECK ((fd = open ("a")) > 1, "open \"a\"");
+  msg ("write \"a\" past a 1 MB hole");
+  memset (buf, 'a', BLOCK_SIZE);
+  seek (fd, HOLE_SIZE);
+  ret_val = write (fd, buf, BLOCK_SIZE);
+  if (ret_val != BLOCK_SIZE)
+    fail ("write %d bytes in \"a\" returned %d", BLOCK_SIZE, ret_val);
+  CHECK (filesize (fd) == HOLE_SIZE + BLOCK_SIZE, "size of \"a\" is %d",
+         HOLE_SIZE + BLOCK_SIZE);
+
+  msg ("resetting buffer");
+  buffer_reset ();
+  msg ("read the hole");
+  reads = buffer_stat (BUFFER_STAT_READS);
+  seek (fd, 0);
+  ret_val = read (fd, buf, READ_SIZE);
+  if (ret_val != READ_SIZE)
+    fail ("read %d bytes in \"a\" returned %d", READ_SIZE, ret_val);
+  compare_bytes (buf, zeros, READ_SIZE, 0, "a");
+  CHECK (buffer_stat (BUFFER_STAT_READS) - reads < 8,
+         "read fewer than 8 sectors");
+  msg ("close \"a\"");
+  close (fd);
+
+  CHECK (create ("b", 0), "create \"b\"");
+  CHECK ((fd = open ("b")) > 1, "open \"b\"");
+  msg ("write \"b\"");
+  memset (buf, 'b', BLOCK_SIZE);
+  for (i = 0; i < B_SIZE / BLOCK_SIZE; i++)
+    {
+      ret_val = write (fd, buf, BLOCK_SIZE);
+      if (ret_val != BLOCK_SIZE)
+        fail ("write %d bytes at offset %d in \"b\" returned %d",
+              BLOCK_SIZE, i * BLOCK_SIZE, ret_val);
+    }
+  msg ("close \"b\"");
+  close (fd);
+
+  CHECK (remove ("a"), "remove \"a\"");
+  CHECK (remove ("b"), "remove \"b\"");
+}
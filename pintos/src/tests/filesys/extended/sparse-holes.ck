@@ -0,0 +1,23 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(sparse-holes) begin
+(sparse-holes) create "a"
+(sparse-holes) open "a"
+(sparse-holes) write "a" past a 1 MB hole
+(sparse-holes) size of "a" is 1049088
+(sparse-holes) resetting buffer
+(sparse-holes) read the hole
+(sparse-holes) read fewer than 8 sectors
+(sparse-holes) close "a"
+(sparse-holes) create "b"
+(sparse-holes) open "b"
+(sparse-holes) write "b"
+(sparse-holes) close "b"
+(sparse-holes) remove "a"
+(sparse-holes) remove "b"
+(sparse-holes) end
+EOF
+pass;
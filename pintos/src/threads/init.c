@@ -243,11 +243,21 @@ parse_options (char **argv)
         shutdown_configure (SHUTDOWN_REBOOT);
 #ifdef FILESYS
       else if (!strcmp (name, "-f"))
-        format_filesys = true;
+        {
+          format_filesys = true;
+          if (value != NULL && !strcmp (value, "extents"))
+            inode_use_extents = true;
+          else if (value != NULL)
+            PANIC ("unknown file system format `%s'", value);
+        }
       else if (!strcmp (name, "-filesys"))
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-cache"))
+        buffer_cache_sectors = atoi (value);
+      else if (!strcmp (name, "-cache-policy"))
+        buffer_cache_policy = value;
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -316,6 +326,7 @@ run_actions (char **argv)
       {"rm", 2, fsutil_rm},
       {"extract", 1, fsutil_extract},
       {"append", 2, fsutil_append},
+      {"cache-bench", 2, fsutil_cache_bench},
 #endif
       {NULL, 0, NULL},
     };
@@ -362,6 +373,7 @@ usage (void)
           "  ls                 List files in the root directory.\n"
           "  cat FILE           Print FILE to the console.\n"
           "  rm FILE            Delete FILE.\n"
+          "  cache-bench COUNT  Time COUNT buffer cache hits per pass.\n"
           "Use these actions indirectly via `pintos' -g and -p options:\n"
           "  extract            Untar from scratch device into file system.\n"
           "  append FILE        Append FILE to tar file on scratch device.\n"
@@ -372,8 +384,11 @@ usage (void)
           "  -r                 Reboot after actions.\n"
 #ifdef FILESYS
           "  -f                 Format file system device during startup.\n"
+          "  -f=extents         Format it, mapping file data with extents.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -cache=SECTORS     Start with a SECTORS-block buffer cache.\n"
+          "  -cache-policy=NAME Use buffer cache policy clock, 2q or arc.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
@@ -42,8 +42,12 @@ syscall_handler (struct intr_frame *f UNUSED)
   // Validate stack argument pointers
   check_ptr (args, sizeof (uint32_t));
   switch (args[0]) {
+    case SYS_FADVISE:
+      check_ptr (&args[4], sizeof (uint32_t));
+      /* Fall through. */
     case SYS_READ:
     case SYS_WRITE:
+    case SYS_FALLOCATE:
       check_ptr (&args[3], sizeof (uint32_t));
     case SYS_CREATE:
     case SYS_SEEK:
@@ -55,6 +59,7 @@ syscall_handler (struct intr_frame *f UNUSED)
     case SYS_WAIT:
     case SYS_REMOVE:
     case SYS_OPEN:
+    case SYS_OPEN_DIRECT:
     case SYS_FILESIZE:
     case SYS_TELL:
     case SYS_ISDIR:
@@ -64,6 +69,7 @@ syscall_handler (struct intr_frame *f UNUSED)
     case SYS_CLOSE:
     case SYS_BUFFER_STAT:
     case SYS_BUFFER_RESET:
+    case SYS_BUFFER_RESIZE:
       check_ptr (&args[1], sizeof (uint32_t));
   }
 
@@ -73,6 +79,7 @@ syscall_handler (struct intr_frame *f UNUSED)
     case SYS_CREATE:
     case SYS_REMOVE:
     case SYS_OPEN:
+    case SYS_OPEN_DIRECT:
     case SYS_MKDIR:
     case SYS_CHDIR:
       check_string ((char *) args[1]);
@@ -124,22 +131,20 @@ syscall_handler (struct intr_frame *f UNUSED)
     f->eax = filesys_create ((char *) args[1], 0, true);
   else if (args[0] == SYS_CHDIR)
     f->eax = filesys_chdir ((char *) args[1]);
-  else if (args[0] == SYS_OPEN) {
+  else if (args[0] == SYS_OPEN || args[0] == SYS_OPEN_DIRECT) {
     struct file *file_ = filesys_open ((char *) args[1]);
+    if (file_ != NULL && args[0] == SYS_OPEN_DIRECT)
+      file_set_direct (file_);
     f->eax = file_ ? add_file_to_process (file_) : -1;
   }
-  else if (args[0] == SYS_BUFFER_STAT) {
-    if (args[1] == 0)
-      f->eax = cache_misses;
-    else if (args[1] == 1)
-      f->eax = cache_hits;
-    else if (args [1] == 2)
-      f->eax = block_read_cnt (fs_device);
-    else if (args [1] == 3)
-      f->eax = block_write_cnt (fs_device);
-  }
-  else if (args[0] == SYS_BUFFER_RESET)
+  else if (args[0] == SYS_BUFFER_STAT)
+    f->eax = buffer_cache_stat (args[1]);
+  else if (args[0] == SYS_BUFFER_RESET) {
+    filesys_flush ();
     buffer_cache_reset ();
+  }
+  else if (args[0] == SYS_BUFFER_RESIZE)
+    f->eax = buffer_cache_resize (args[1]);
   else {
     // For the remaining syscalls, args[1] is a file descriptor.
     struct fnode *fn = get_file_from_fd (args[1]);
@@ -159,6 +164,11 @@ syscall_handler (struct intr_frame *f UNUSED)
       f->eax = file_isdir (fn->file);
     else if (args[0] == SYS_INUMBER)
       f->eax = file_inumber (fn->file);
+    else if (args[0] == SYS_FADVISE)
+      f->eax = file_advise (fn->file, args[2], args[3], args[4]);
+    else if (args[0] == SYS_FALLOCATE)
+      f->eax = !file_isdir (fn->file)
+               && file_allocate (fn->file, args[2], args[3]);
     else if (args[0] == SYS_READDIR)
       f->eax = dir_readdir ((struct dir *) fn->file, (char *) args[2]);
     else if (args[0] == SYS_CLOSE) {